@@ -19,6 +19,8 @@
 #include <common.h>
 
 void cpu_exec(uint64_t n);
+void cpu_exec_ref(uint64_t n);
+void cpu_request_stop();
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret);
 void invalid_inst(vaddr_t thispc);
@@ -23,7 +23,6 @@ typedef struct Decode {
   vaddr_t snpc; // static next pc
   vaddr_t dnpc; // dynamic next pc
   ISADecodeInfo isa;
-  IFDEF(CONFIG_ITRACE, char logbuf[128]);
 } Decode;
 
 // --- pattern matching mechanism ---
@@ -87,10 +86,17 @@ finish:
 
 
 // --- pattern matching wrappers for decode ---
+#ifdef CONFIG_ISTAT
+#define INSTPAT_ISTAT(name, ...) istat_inst(#name)
+#else
+#define INSTPAT_ISTAT(...)
+#endif
+
 #define INSTPAT(pattern, ...) do { \
   uint64_t key, mask, shift; \
   pattern_decode(pattern, STRLEN(pattern), &key, &mask, &shift); \
   if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
+    INSTPAT_ISTAT(__VA_ARGS__); \
     INSTPAT_MATCH(s, ##__VA_ARGS__); \
     goto *(__instpat_end); \
   } \
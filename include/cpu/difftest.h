@@ -18,6 +18,7 @@
 
 #include <common.h>
 #include <difftest-def.h>
+#include <memory/paddr.h>
 
 #ifdef CONFIG_DIFFTEST
 void difftest_skip_ref();
@@ -27,6 +28,10 @@ void difftest_step(vaddr_t pc, vaddr_t npc);
 void difftest_detach();
 void difftest_attach();
 void difftest_load();
+void difftest_mmio_access(paddr_t addr, int len, word_t data, bool is_write);
+void difftest_sync_mem(paddr_t addr, size_t n);
+void difftest_sync_reg();
+void difftest_intr(word_t NO);
 #else
 static inline void difftest_skip_ref() {}
 static inline void difftest_skip_dut(int nr_ref, int nr_dut) {}
@@ -35,12 +40,41 @@ static inline void difftest_step(vaddr_t pc, vaddr_t npc) {}
 static inline void difftest_detach() {}
 static inline void difftest_attach() {}
 static inline void difftest_load() {}
+static inline void difftest_mmio_access(paddr_t addr, int len, word_t data, bool is_write) {}
+static inline void difftest_sync_mem(paddr_t addr, size_t n) {}
+static inline void difftest_sync_reg() {}
+static inline void difftest_intr(word_t NO) {}
 #endif
 
 extern void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction);
 extern void (*ref_difftest_regcpy)(void *dut, bool direction);
 extern void (*ref_difftest_exec)(uint64_t n);
 extern void (*ref_difftest_raise_intr)(uint64_t NO);
+extern void (*ref_difftest_mmio_replay)(paddr_t addr, int len, word_t data, bool is_write);
+extern void (*ref_difftest_statecpy)(void *state, bool direction);
+
+// checkpoints for repro, see src/cpu/difftest/repro.c
+#ifdef CONFIG_DIFFTEST_REPRO
+#define REPRO_NR_PAGE (CONFIG_MSIZE >> PAGE_SHIFT)
+
+extern uint8_t repro_dirty[REPRO_NR_PAGE / 8];
+
+// called before [addr, addr + len) in pmem is written, the pages are copied by the next checkpoint
+static inline void repro_pmem_write(paddr_t addr, int len) {
+  uint32_t first = (addr - CONFIG_MBASE) >> PAGE_SHIFT, last = (addr + len - 1 - CONFIG_MBASE) >> PAGE_SHIFT;
+  repro_dirty[first / 8] |= 1 << (first % 8);
+  if (last != first && last < REPRO_NR_PAGE) repro_dirty[last / 8] |= 1 << (last % 8);
+}
+#endif
+void repro_checkpoint(bool full);
+void repro_invalidate();
+void repro_step();
+void repro_dump();
+void repro_load(const char *file);
+
+// used when NEMU itself is the REF, see src/cpu/difftest/ref.c
+word_t difftest_replay_mmio_read(paddr_t addr, int len);
+void difftest_replay_mmio_write(paddr_t addr, int len, word_t data);
 
 static inline bool difftest_check_reg(const char *name, vaddr_t pc, word_t ref, word_t dut) {
   if (ref != dut) {
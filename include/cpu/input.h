@@ -0,0 +1,46 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __CPU_INPUT_H__
+#define __CPU_INPUT_H__
+
+#include <common.h>
+
+// the position to keep none of the inputs, see input_keep()
+#define INPUT_KEEP_NONE UINT64_MAX
+
+// the log of device inputs, see src/cpu/input.c
+bool input_replaying();
+word_t input_query_intr();
+void input_resume();
+void input_mmio(paddr_t addr, int len, word_t data);
+word_t input_replay_mmio(paddr_t addr, int len);
+void input_dma(paddr_t addr, int len);
+void input_replay_dma(paddr_t addr, int len);
+void input_redo_dma();
+uint64_t input_pos();
+void input_keep(uint64_t pos);
+void input_seek(uint64_t pos, uint64_t end);
+void input_reset();
+int64_t input_save(FILE *fp, uint64_t pos, uint64_t inst);
+void input_load(FILE *fp, const char *file);
+
+// record and replay of the whole run
+void record_open(const char *file);
+void replay_open(const char *file);
+void record_flush();
+
+#endif
@@ -0,0 +1,57 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __CPU_REVERSE_H__
+#define __CPU_REVERSE_H__
+
+#include <common.h>
+#include <memory/paddr.h>
+
+#ifdef CONFIG_REVERSE
+#define REV_NR_PAGE (CONFIG_MSIZE >> PAGE_SHIFT)
+
+extern uint64_t rev_next;
+extern bool rev_replaying;
+extern uint8_t rev_saved[REV_NR_PAGE / 8];
+void rev_event();
+void rev_save_page(uint32_t page);
+
+// called before every instruction with the number of instructions executed
+static inline void rev_tick(uint64_t nr_inst) {
+  if (unlikely(nr_inst >= rev_next)) rev_event();
+}
+
+// called before the guest stores to [addr, addr + len) in pmem
+static inline void rev_pmem_write(paddr_t addr, int len) {
+  uint32_t first = (addr - CONFIG_MBASE) >> PAGE_SHIFT, last = (addr + len - 1 - CONFIG_MBASE) >> PAGE_SHIFT;
+  if (unlikely(!(rev_saved[first / 8] >> (first % 8) & 1))) rev_save_page(first);
+  if (unlikely(last != first && last < REV_NR_PAGE && !(rev_saved[last / 8] >> (last % 8) & 1))) rev_save_page(last);
+}
+
+// true if the devices have seen the accesses of the replayed guest
+static inline bool rev_replay_device() {
+  return rev_replaying && nemu_state.state == NEMU_RUNNING;
+}
+#endif
+
+// snapshots for reverse execution, see src/cpu/reverse.c
+void rev_dma_write(paddr_t addr, int len);
+void rev_reset();
+int rev_stepi(uint64_t n);
+int rev_continue();
+uint64_t rev_present_inst();
+
+#endif
@@ -31,6 +31,15 @@ enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
 #define RISCV_GPR_TYPE MUXDEF(CONFIG_RV64, uint64_t, uint32_t)
 #define RISCV_GPR_NUM  MUXDEF(CONFIG_RVE , 16, 32)
 #define DIFFTEST_REG_SIZE (sizeof(RISCV_GPR_TYPE) * (RISCV_GPR_NUM + 1)) // GPRs + pc
+// CSRs and privilege mode, exchanged by the optional `difftest_statecpy()'.
+// Bit i of `csr_mask' selects csr[i], which follows the order of CSRS()
+// in src/isa/riscv32/local-include/reg.h. Unselected CSRs are not copied.
+#define DIFFTEST_MAX_CSR 32
+typedef struct {
+  uint32_t csr_mask;
+  uint32_t mode;
+  RISCV_GPR_TYPE csr[DIFFTEST_MAX_CSR];
+} difftest_state_t;
 #elif defined(CONFIG_ISA_loongarch32r)
 # define DIFFTEST_REG_SIZE (sizeof(uint32_t) * 33) // GPRs + pc
 #else
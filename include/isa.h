@@ -32,6 +32,7 @@ void init_isa();
 extern CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
+word_t *isa_reg_str2ptr(const char *name);
 
 // exec
 struct Decode;
@@ -45,11 +46,13 @@ enum { MEM_RET_OK, MEM_RET_FAIL, MEM_RET_CROSS_PAGE };
 int isa_mmu_check(vaddr_t vaddr, int len, int type);
 #endif
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type);
+bool isa_mmu_debug_translate(vaddr_t vaddr, paddr_t *paddr);
 
 // interrupt/exception
 vaddr_t isa_raise_intr(word_t NO, vaddr_t epc);
 #define INTR_EMPTY ((word_t)-1)
 word_t isa_query_intr();
+void isa_clear_intr();  // drop the pending interrupt raised by the devices
 vaddr_t isa_intr_ret();
 
 // difftest
@@ -17,13 +17,12 @@
 #define __MEMORY_VADDR_H__
 
 #include <common.h>
+#include <memory/paddr.h>
 
 word_t vaddr_ifetch(vaddr_t addr, int len);
 word_t vaddr_read(vaddr_t addr, int len);
 void vaddr_write(vaddr_t addr, int len, word_t data);
-
-#define PAGE_SHIFT        12
-#define PAGE_SIZE         (1ul << PAGE_SHIFT)
-#define PAGE_MASK         (PAGE_SIZE - 1)
+word_t vaddr_copy_out(void *buf, vaddr_t addr, word_t len);
+bool vaddr_debug_to_paddr(vaddr_t vaddr, paddr_t *paddr);
 
 #endif
@@ -22,16 +22,86 @@
 
 word_t expr(char *e, bool *success);
 
+// compiled expression, an AST with the children before their parent
+typedef struct {
+  int op;
+  int child[3];
+  word_t imm;
+  word_t *reg;       // the register read, if it can be accessed directly
+  const char *name;  // the register read through isa_reg_str2val()
+} ExprOp;
+typedef struct {
+  ExprOp *op;
+  int nr_op, size;
+} ExprCode;
+bool expr_compile(char *e, ExprCode *code);
+word_t expr_run(const ExprCode *code, bool *success, void (*on_read)(void *arg, vaddr_t addr, int len), void *arg);
+void expr_free(ExprCode *code);
+
 // checkpoint
 void init_wp_pool();
 bool add_wp(char *s_expr);
 bool del_wp(int n);
 void display_wp();
 bool check_wp();
+void wp_resync();
+extern int wp_nr_mem;
+void wp_store(vaddr_t addr, int len);
+int new_point_NO();
+
+// the point which stopped the last execution, cleared by the caller
+enum { STOP_NONE, STOP_WP, STOP_BP, STOP_MWP };  // STOP_MWP + MWP_READ, ...
+typedef struct {
+  int type;
+  vaddr_t addr;  // the pc of a breakpoint, or the watched address accessed
+} PointStop;
+extern PointStop point_stop;
+// set while the execution is replayed, the points neither print nor count the hits
+extern bool point_quiet;
+
+// breakpoint
+#define BP_BITMAP_BITS (1 << 16)
+extern uint8_t bp_bitmap[BP_BITMAP_BITS / 8];
+// false if there is no breakpoint at PC, true if there may be one
+static inline bool bp_maybe(vaddr_t pc) {
+  uint32_t idx = pc & (BP_BITMAP_BITS - 1);
+  return (bp_bitmap[idx / 8] >> (idx % 8)) & 1;
+}
+int add_bp(vaddr_t pc, char *cond);
+bool del_bp(int n);
+void display_bp();
+bool check_bp(vaddr_t pc);
+
+// memory access watchpoint
+enum { MWP_READ = 1, MWP_WRITE = 2, MWP_ACCESS = MWP_READ | MWP_WRITE };
+#define MWP_BITMAP_BITS (1 << 20)
+extern uint8_t mwp_bitmap[2][MWP_BITMAP_BITS / 8];
+// false if no watchpoint of TYPE is on the page of ADDR
+static inline bool mwp_maybe(int type, vaddr_t addr) {
+  uint32_t idx = (addr >> 12) & (MWP_BITMAP_BITS - 1);
+  return (mwp_bitmap[type >> 1][idx / 8] >> (idx % 8)) & 1;
+}
+int add_mwp(int type, vaddr_t addr, word_t len);
+bool del_mwp(int n);
+void display_mwp();
+void mwp_access(int type, vaddr_t addr, int len, word_t data);
+// the first access hitting a watchpoint in the current instruction
+typedef struct {
+  struct mem_watchpoint *mwp;
+  int type;
+  vaddr_t addr;
+  int len;
+  word_t data;
+  vaddr_t pc;
+} MWPHit;
+extern MWPHit mwp_pending;
+struct Decode;
+void mwp_report(struct Decode *s);
 
 // instruction trace ring buffer
-void inst_history_add(const char *);
+void inst_history_add(vaddr_t pc, const uint8_t *inst, int ilen);
 void inst_history_print();
+void itrace_format(char *buf, int size, vaddr_t pc, const uint8_t *inst, int ilen);
 
 // function trace
 #define SYMBOL_NAME_MAX_LEN 128
@@ -40,10 +110,13 @@ struct function_info {
     char name[SYMBOL_NAME_MAX_LEN];
     word_t start_address;
     word_t end_address;
+    int id;  // registration order
 };
+extern struct function_info *function_list;
 void register_function(bool is_function, const char *name, word_t start_address, word_t end_address);
 void print_function_info();
 int search_function(word_t address);
+bool function_addr(const char *name, word_t *addr);
 
 enum function_trace_type { FUNCTION_CALL, FUNCTION_RETURN };
 struct function_trace_item {
@@ -60,4 +133,16 @@ void print_function_trace();
 void print_function_stack();
 void function_stack_save(FILE *fp);
 void function_stack_load(FILE *fp);
+
+// gdb remote stub
+extern bool gdb_enabled;
+void gdb_listen(const char *addr);
+void gdb_mainloop();
+
+// function profiler
+extern bool fprof_enabled;
+void fprof_open(const char *file);
+void fprof_call(int caller, word_t target, int callee);
+void fprof_ret();
+void fprof_display(int n);
 #endif
@@ -0,0 +1,44 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __PCTRACE_DEF_H__
+#define __PCTRACE_DEF_H__
+
+#include <stdint.h>
+
+// This file is shared by the PC tracer (src/utils/pctrace.c)
+// and the reader (tools/pctrace-reader).
+
+#define PCTRACE_MAGIC "NEMUPCT"
+#define PCTRACE_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t ilen;        // length of every instruction, 0 if it is variable
+  uint64_t entry;       // pc of the first instruction
+  uint64_t start_inst;  // number of instructions executed before
+} PCTraceHeader;
+
+/* The header is followed by events. An event is 3 LEB128 varints:
+ *   (n << 2) | kind      n instructions are executed sequentially
+ *                        from the target of the previous event
+ *   src - prev_target    pc of the last of the n instructions (JUMP),
+ *                        or the pc where the run is broken (TRAP, END)
+ *   zigzag(target - src) where the execution continues
+ */
+enum { PCTRACE_JUMP, PCTRACE_TRAP, PCTRACE_END };
+
+#endif
@@ -0,0 +1,56 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __TRACE_DEF_H__
+#define __TRACE_DEF_H__
+
+#include <stdint.h>
+
+// This file is shared by the binary tracer (src/utils/btrace.c)
+// and the offline decoder (tools/trace-decode).
+
+#define TRACE_CATS(_) _(inst) _(mem) _(dev) _(func) _(exc) _(csr)
+#define TRACE_CAT_ENUM(x) TRACE_##x,
+enum { TRACE_CATS(TRACE_CAT_ENUM) NR_TRACE_CAT };
+
+enum { TRACE_READ, TRACE_WRITE }; // type of mem and dev
+enum { TRACE_CALL, TRACE_RET };   // type of func
+
+#define TRACE_MAGIC "NEMUTRC"
+#define TRACE_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  char isa[16];
+} TraceHeader;
+
+// The meaning of the fields depends on the category:
+//   inst: a = pc, b/c = instruction bytes 0-7/8-15, len = length of the instruction
+//   mem:  a = paddr, b = data, len = access size, type = read/write
+//   dev:  a = address, b = data, c = offset in the device, len and type as mem
+//   func: a = pc, b = target, type = call/ret
+//   exc:  a = epc, b = NO, c = address of the handler
+//   csr:  a = pc, b = csr address, c = source operand, type = funct3 of the instruction
+typedef struct {
+  uint64_t inst; // number of instructions executed before the record
+  uint64_t a, b, c;
+  uint8_t cat, type;
+  uint16_t len;
+  uint32_t pad;
+} TraceRecord;
+
+#endif
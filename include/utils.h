@@ -56,13 +56,20 @@ uint64_t get_time();
 
 #define ANSI_FMT(str, fmt) fmt str ANSI_NONE
 
+#ifdef CONFIG_LOG_ASYNC
+void log_async_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_flush();
+#define log_write_fp(...) log_async_printf(__VA_ARGS__)
+#else
+#define log_write_fp(...) do { fprintf(log_fp, __VA_ARGS__); fflush(log_fp); } while (0)
+#endif
+
 #define log_write(...) IFDEF(CONFIG_TARGET_NATIVE_ELF, \
   do { \
     extern FILE* log_fp; \
     extern bool log_enable(); \
     if (log_enable() && log_fp != NULL) { \
-      fprintf(log_fp, __VA_ARGS__); \
-      fflush(log_fp); \
+      log_write_fp(__VA_ARGS__); \
     } \
   } while (0) \
 )
@@ -73,5 +80,74 @@ uint64_t get_time();
     log_write(__VA_ARGS__); \
   } while (0)
 
+// ----------- binary trace -----------
+
+#ifdef CONFIG_BTRACE
+#include <trace-def.h>
+
+extern uint32_t btrace_mask;
+void btrace_record(int cat, int type, int len, uint64_t a, uint64_t b, uint64_t c);
+bool btrace_set_mask(const char *list);
+void btrace_display();
+bool btrace_dump(const char *file);
+void btrace_open(const char *file);
+
+// the category is checked inline, so a disabled category only costs a branch
+#define btrace(cat, type, len, a, b, c) do { \
+  if (unlikely(btrace_mask & (1u << TRACE_##cat))) \
+    btrace_record(TRACE_##cat, type, len, a, b, c); \
+} while (0)
+#else
+#define btrace(cat, type, len, a, b, c)
+#endif
+
+// ----------- pc trace -----------
+
+#ifdef CONFIG_PCTRACE
+extern bool pctrace_enabled;
+void pctrace_open(const char *file);
+void pctrace_jump(vaddr_t pc, vaddr_t target);
+void pctrace_trap(vaddr_t epc, vaddr_t target);
+#endif
+
+// ----------- pc profiler -----------
+
+#ifdef CONFIG_PCPROF
+#include <signal.h>
+extern uint64_t pcprof_countdown;
+extern volatile sig_atomic_t pcprof_tick;
+extern vaddr_t pcprof_bb;
+void pcprof_start(const char *arg);
+void pcprof_sample(vaddr_t pc);
+#endif
+
+// ----------- instruction statistics -----------
+
+#ifdef CONFIG_ISTAT
+typedef struct IStatInst {
+  const char *name;
+  uint64_t count;
+  struct IStatInst *next;
+} IStatInst;
+void istat_register(IStatInst *p);
+// the counter of an INSTPAT, registered when it is first matched
+#define istat_inst(n) do { \
+  static IStatInst __istat = { .name = n }; \
+  if (istat_enabled() && unlikely(__istat.count ++ == 0)) istat_register(&__istat); \
+} while (0)
+#ifdef CONFIG_REVERSE
+extern bool rev_replaying;
+#endif
+// the debugger accesses the guest while NEMU is not running, and the reverse
+// replay executes the instructions counted before
+#define istat_enabled() (likely(nemu_state.state == NEMU_RUNNING) && !MUXDEF(CONFIG_REVERSE, rev_replaying, false))
+extern uint64_t istat_load[9], istat_store[9], istat_branch[2], istat_tlb[2];
+#define istat_count(c) do { if (istat_enabled()) (c) ++; } while (0)
+void istat_device(const char *name, bool is_write);
+void istat_trap(word_t NO);
+#endif
+void istat_init(const char *file);
+void istat_display();
+
 
 #endif
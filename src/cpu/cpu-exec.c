@@ -16,8 +16,13 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <cpu/input.h>
+#include <cpu/reverse.h>
 #include <locale.h>
 #include <monitor/sdb.h>
+#ifndef CONFIG_TARGET_AM
+#include <stdatomic.h>
+#endif
 
 /* The assembly code of instructions executed is only output to the screen
  * when the number of instructions executed is less than this value.
@@ -30,17 +35,36 @@ CPU_state cpu = {};
 uint64_t g_nr_guest_inst = 0;
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
+#ifndef CONFIG_TARGET_AM
+static atomic_bool stop_request = false;
+#endif
 
 void device_update();
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
+#ifdef CONFIG_ITRACE
+  // the instruction is only disassembled when the text is really output
+  uint8_t *inst = (uint8_t *)&_this->isa.inst;
+  int ilen = _this->snpc - _this->pc;
+  char logbuf[128];
 #ifdef CONFIG_ITRACE_COND
   if (ITRACE_COND) {
-    log_write("%s\n", _this->logbuf);
-    inst_history_add(_this->logbuf);
+    extern bool log_enable();
+    if (log_enable()) {
+      itrace_format(logbuf, sizeof(logbuf), _this->pc, inst, ilen);
+      log_write("%s\n", logbuf);
+    }
+    inst_history_add(_this->pc, inst, ilen);
+  }
+#endif
+  if (g_print_step) {
+    itrace_format(logbuf, sizeof(logbuf), _this->pc, inst, ilen);
+    puts(logbuf);
   }
 #endif
-  if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
+#ifdef CONFIG_PCTRACE
+  if (unlikely(pctrace_enabled) && dnpc != _this->snpc) pctrace_jump(_this->pc, dnpc);
+#endif
   IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
 #ifdef CONFIG_WATCHPOINT
 #ifndef CONFIG_TARGET_AM
@@ -56,45 +80,64 @@ static void exec_once(Decode *s, vaddr_t pc) {
   s->snpc = pc;
   isa_exec_once(s);
   cpu.pc = s->dnpc;
-#ifdef CONFIG_ITRACE
-  char *p = s->logbuf;
-  p += snprintf(p, sizeof(s->logbuf), FMT_WORD ":", s->pc);
-  int ilen = s->snpc - s->pc;
-  int i;
-  uint8_t *inst = (uint8_t *)&s->isa.inst;
-#ifdef CONFIG_ISA_x86
-  for (i = 0; i < ilen; i ++) {
-#else
-  for (i = ilen - 1; i >= 0; i --) {
-#endif
-    p += snprintf(p, 4, " %02x", inst[i]);
+#ifdef CONFIG_BTRACE
+  if (unlikely(btrace_mask & (1u << TRACE_inst))) {
+    uint64_t raw[2] = {};
+    static_assert(sizeof(s->isa.inst) <= sizeof(raw), "instruction buffer is too large");
+    memcpy(raw, &s->isa.inst, sizeof(s->isa.inst));
+    btrace_record(TRACE_inst, 0, s->snpc - s->pc, s->pc, raw[0], raw[1]);
   }
-  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
-  int space_len = ilen_max - ilen;
-  if (space_len < 0) space_len = 0;
-  space_len = space_len * 3 + 1;
-  memset(p, ' ', space_len);
-  p += space_len;
-
-  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
-  disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
-      MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst, ilen);
 #endif
 }
 
 static void execute(uint64_t n) {
   Decode s;
+  IFDEF(CONFIG_INPUT_LOG, input_resume());
   for (;n > 0; n --) {
+    IFDEF(CONFIG_REVERSE, rev_tick(g_nr_guest_inst));
     exec_once(&s, cpu.pc);
     g_nr_guest_inst ++;
+#ifdef CONFIG_PCPROF
+    if (unlikely(-- pcprof_countdown == 0 || pcprof_tick)) pcprof_sample(s.pc);
+    if (s.dnpc != s.snpc) pcprof_bb = s.dnpc;
+#endif
     trace_and_difftest(&s, cpu.pc);
+#if defined(CONFIG_MEMWATCH) && !defined(CONFIG_TARGET_AM)
+    if (unlikely(mwp_pending.mwp != NULL) && nemu_state.state == NEMU_RUNNING) nemu_state.state = NEMU_STOP;
+#endif
     if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
-    word_t intr = isa_query_intr();
+#ifdef CONFIG_DEVICE
+    // the replay takes the device inputs from the log
+    if (!MUXDEF(CONFIG_REVERSE, rev_replaying, false)) device_update();
+#endif
+    // the interrupt taken after the instruction, from the devices or from the log of them
+    word_t intr = MUXDEF(CONFIG_INPUT_LOG, input_query_intr(), isa_query_intr());
     if (intr != INTR_EMPTY) {
-      cpu.pc = isa_raise_intr(intr, cpu.pc);
+      vaddr_t target = isa_raise_intr(intr, cpu.pc);
+#ifdef CONFIG_PCTRACE
+      if (unlikely(pctrace_enabled)) pctrace_trap(cpu.pc, target);
+#endif
+      cpu.pc = target;
+      IFDEF(CONFIG_DIFFTEST, difftest_intr(intr));
+    }
+#if defined(CONFIG_BREAKPOINT) && !defined(CONFIG_TARGET_AM)
+    if (unlikely(bp_maybe(cpu.pc)) && check_bp(cpu.pc)) {
+      nemu_state.state = NEMU_STOP;
+      break;
     }
+#endif
+#ifndef CONFIG_TARGET_AM
+    // only checked at the end of a basic block, which is soon enough
+    if (s.dnpc != s.snpc && unlikely(atomic_load_explicit(&stop_request, memory_order_relaxed))) {
+      stop_request = false;
+      nemu_state.state = NEMU_STOP;
+      break;
+    }
+#endif
   }
+#if defined(CONFIG_MEMWATCH) && !defined(CONFIG_TARGET_AM)
+  mwp_report(&s);
+#endif
 }
 
 static void statistic() {
@@ -104,13 +147,26 @@ static void statistic() {
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_LOG_ASYNC, log_flush());
 }
 
 void assert_fail_msg() {
+  IFDEF(CONFIG_RECORD, record_flush());
+  IFDEF(CONFIG_ITRACE, inst_history_print());
   isa_reg_display();
   statistic();
 }
 
+#ifndef CONFIG_TARGET_AM
+/* Stop the guest at the end of the current basic block, or at the first
+ * one of the next `cpu_exec()' if it is not started yet. This is called by
+ * the sdb thread and by the SIGINT handler, so it only sets a flag.
+ */
+void cpu_request_stop() {
+  stop_request = true;
+}
+#endif
+
 /* Simulate how the CPU works. */
 void cpu_exec(uint64_t n) {
   g_print_step = (n < MAX_INST_TO_PRINT);
@@ -127,11 +183,15 @@ void cpu_exec(uint64_t n) {
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
+  IFNDEF(CONFIG_TARGET_AM, stop_request = false);
 
   switch (nemu_state.state) {
     case NEMU_RUNNING: nemu_state.state = NEMU_STOP; break;
 
     case NEMU_END: case NEMU_ABORT:
+#ifdef CONFIG_ITRACE
+      if (nemu_state.state == NEMU_ABORT) inst_history_print();
+#endif
       Log("nemu: %s at pc = " FMT_WORD,
           (nemu_state.state == NEMU_ABORT ? ANSI_FMT("ABORT", ANSI_FG_RED) :
            (nemu_state.halt_ret == 0 ? ANSI_FMT("HIT GOOD TRAP", ANSI_FG_GREEN) :
@@ -141,3 +201,16 @@ void cpu_exec(uint64_t n) {
     case NEMU_QUIT: statistic();
   }
 }
+
+/* Used by the REF side of differential testing, which is driven
+ * one instruction at a time by the DUT, and by the replay of reverse
+ * execution. The host timer and the messages in `cpu_exec()' are
+ * skipped since they cost more than the instruction itself.
+ */
+void cpu_exec_ref(uint64_t n) {
+  if (nemu_state.state != NEMU_RUNNING && nemu_state.state != NEMU_STOP) return;
+  g_print_step = false;
+  nemu_state.state = NEMU_RUNNING;
+  execute(n);
+  if (nemu_state.state == NEMU_RUNNING) nemu_state.state = NEMU_STOP;
+}
@@ -19,12 +19,14 @@
 #include <cpu/cpu.h>
 #include <memory/paddr.h>
 #include <utils.h>
-#include <difftest-def.h>
+#include <cpu/difftest.h>
 
 void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) = NULL;
 void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
 void (*ref_difftest_exec)(uint64_t n) = NULL;
 void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
+void (*ref_difftest_mmio_replay)(paddr_t addr, int len, word_t data, bool is_write) = NULL;
+void (*ref_difftest_statecpy)(void *state, bool direction) = NULL;
 
 #ifdef CONFIG_DIFFTEST
 
@@ -32,6 +34,16 @@ static bool enable_difftest = false;
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
 
+#define NR_MMIO_RECORD 16
+typedef struct {
+  paddr_t addr;
+  int len;
+  word_t data;
+  bool is_write;
+} MMIORecord;
+static MMIORecord mmio_record[NR_MMIO_RECORD];
+static int nr_mmio_record = 0;
+
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
 void difftest_skip_ref() {
@@ -62,6 +74,39 @@ void difftest_skip_dut(int nr_ref, int nr_dut) {
   }
 }
 
+// this is used to record the device accesses of the current instruction.
+// If REF supports it, the accesses are replayed into REF so that REF can
+// execute and check the instruction by itself. Otherwise we fall back to
+// skip the instruction in REF.
+void difftest_mmio_access(paddr_t addr, int len, word_t data, bool is_write) {
+  // accesses from the monitor (e.g. the `x' command) are not part of any instruction
+  if (!enable_difftest || nemu_state.state != NEMU_RUNNING) return;
+  if (ref_difftest_mmio_replay == NULL || nr_mmio_record == NR_MMIO_RECORD) {
+    difftest_skip_ref();
+    return;
+  }
+  mmio_record[nr_mmio_record ++] = (MMIORecord) {
+    .addr = addr, .len = len, .data = data, .is_write = is_write };
+}
+
+// this is used by devices which modify pmem directly (e.g. DMA),
+// since REF does not have such devices
+void difftest_sync_mem(paddr_t addr, size_t n) {
+#ifdef CONFIG_DIFFTEST_REPRO
+  for (paddr_t a = addr & ~PAGE_MASK; a < addr + n; a += PAGE_SIZE) repro_pmem_write(a, 1);
+#endif
+  if (!enable_difftest) return;
+  ref_difftest_memcpy(addr, guest_to_host(addr), n, DIFFTEST_TO_REF);
+}
+
+// called after the debugger changes the registers of DUT, or the memory
+// with `difftest_sync_mem()', the repro starts from the changed state
+void difftest_sync_reg() {
+  if (!enable_difftest) return;
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  IFDEF(CONFIG_DIFFTEST_REPRO, repro_checkpoint(false));
+}
+
 void init_difftest(char *ref_so_file, long img_size, int port) {
   assert(ref_so_file != NULL);
 
@@ -84,25 +129,39 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
   assert(ref_difftest_init);
 
+  // optional, see difftest_mmio_access()
+  ref_difftest_mmio_replay = dlsym(handle, "difftest_mmio_replay");
+
+  // optional, the ISA state beyond GPRs and pc (see difftest-def.h)
+  ref_difftest_statecpy = dlsym(handle, "difftest_statecpy");
+
   Log("Differential testing: %s", ANSI_FMT("ON", ANSI_FG_GREEN));
   Log("The result of every instruction will be compared with %s. "
       "This will help you a lot for debugging, but also significantly reduce the performance. "
       "If it is not necessary, you can turn it off in menuconfig.", ref_so_file);
+  Log("Instructions accessing devices are %s in REF",
+      ref_difftest_mmio_replay ? "replayed with the values read by DUT" : "skipped");
+  if (ref_difftest_statecpy) Log("CSRs and privilege mode are also compared");
 
   ref_difftest_init(port);
   ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
   enable_difftest = true;
+  IFDEF(CONFIG_DIFFTEST_REPRO, repro_checkpoint(true));
 }
 
 void difftest_load() {
   ref_difftest_memcpy(CONFIG_MBASE, guest_to_host(CONFIG_MBASE), CONFIG_MSIZE, DIFFTEST_TO_REF);
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
   isa_difftest_attach();
+  // the whole memory may be changed by the debugger without going through `paddr_write()'
+  IFDEF(CONFIG_DIFFTEST_REPRO, repro_checkpoint(true));
 }
 
 void difftest_detach() {
   enable_difftest = false;
+  nr_mmio_record = 0;
+  IFDEF(CONFIG_DIFFTEST_REPRO, repro_invalidate());
 }
 
 void difftest_attach() {
@@ -115,9 +174,20 @@ static void checkregs(CPU_state *ref, vaddr_t pc) {
     nemu_state.state = NEMU_ABORT;
     nemu_state.halt_pc = pc;
     isa_reg_display();
+    IFDEF(CONFIG_DIFFTEST_REPRO, repro_dump());
   }
 }
 
+// this is used to deliver the interrupt taken by DUT to REF at the
+// same instruction boundary, since REF does not have any devices
+void difftest_intr(word_t NO) {
+  if (!enable_difftest) return;
+  ref_difftest_raise_intr(NO);
+  CPU_state ref_r;
+  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  checkregs(&ref_r, cpu.pc);
+}
+
 void difftest_step(vaddr_t pc, vaddr_t npc) {
   if (!enable_difftest) return;
   CPU_state ref_r;
@@ -139,13 +209,21 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
     // to skip the checking of an instruction, just copy the reg state to reference design
     ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
     is_skip_ref = false;
+    nr_mmio_record = 0;
     return;
   }
 
+  for (int i = 0; i < nr_mmio_record; i ++) {
+    MMIORecord *r = &mmio_record[i];
+    ref_difftest_mmio_replay(r->addr, r->len, r->data, r->is_write);
+  }
+  nr_mmio_record = 0;
+
   ref_difftest_exec(1);
   ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
 
   checkregs(&ref_r, pc);
+  IFDEF(CONFIG_DIFFTEST_REPRO, repro_step());
 }
 #else
 void init_difftest(char *ref_so_file, long img_size, int port) { }
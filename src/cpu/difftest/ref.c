@@ -15,23 +15,80 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/difftest.h>
 #include <difftest-def.h>
 #include <memory/paddr.h>
 
+// The DUT buffer is accessed in place and copied to/from pmem in one shot,
+// so there is no staging buffer between the two NEMU instances.
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(0);
+  Assert(in_pmem(addr) && (n == 0 || in_pmem(addr + n - 1)),
+      "difftest_memcpy: [" FMT_PADDR ", " FMT_PADDR ") is out of bound of pmem", addr, (paddr_t)(addr + n));
+  if (direction == DIFFTEST_TO_REF) memcpy(guest_to_host(addr), buf, n);
+  else memcpy(buf, guest_to_host(addr), n);
 }
 
+// Only the registers defined by the difftest protocol (see DIFFTEST_REG_SIZE)
+// are exchanged. They are located at the beginning of `CPU_state'.
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) memcpy(&cpu, dut, DIFFTEST_REG_SIZE);
+  else memcpy(dut, &cpu, DIFFTEST_REG_SIZE);
+}
+
+// REF does not have any devices. Device accesses are replayed with
+// the values recorded by DUT, and checked against what DUT does.
+#define NR_MMIO_REPLAY 16
+static struct {
+  paddr_t addr;
+  int len;
+  word_t data;
+  bool is_write;
+} mmio_replay[NR_MMIO_REPLAY];
+static int mmio_replay_head = 0, mmio_replay_tail = 0;
+
+__EXPORT void difftest_mmio_replay(paddr_t addr, int len, word_t data, bool is_write) {
+  Assert(mmio_replay_tail < NR_MMIO_REPLAY, "too many device accesses to replay");
+  mmio_replay[mmio_replay_tail].addr = addr;
+  mmio_replay[mmio_replay_tail].len = len;
+  mmio_replay[mmio_replay_tail].data = data;
+  mmio_replay[mmio_replay_tail].is_write = is_write;
+  mmio_replay_tail ++;
+}
+
+static word_t replay_mmio(paddr_t addr, int len, word_t data, bool is_write) {
+  Assert(mmio_replay_head < mmio_replay_tail,
+      "REF %s %d byte(s) at " FMT_PADDR " at pc = " FMT_WORD ", but DUT does not",
+      is_write ? "writes" : "reads", len, addr, cpu.pc);
+  int i = mmio_replay_head ++;
+  Assert(mmio_replay[i].addr == addr && mmio_replay[i].len == len &&
+      mmio_replay[i].is_write == is_write && (!is_write || mmio_replay[i].data == data),
+      "device access is different at pc = " FMT_WORD ", "
+      "REF %s %d byte(s) at " FMT_PADDR " with data = " FMT_WORD ", "
+      "DUT %s %d byte(s) at " FMT_PADDR " with data = " FMT_WORD,
+      cpu.pc, is_write ? "writes" : "reads", len, addr, data,
+      mmio_replay[i].is_write ? "writes" : "reads", mmio_replay[i].len,
+      mmio_replay[i].addr, mmio_replay[i].data);
+  return mmio_replay[i].data;
+}
+
+word_t difftest_replay_mmio_read(paddr_t addr, int len) {
+  return replay_mmio(addr, len, 0, false);
+}
+
+void difftest_replay_mmio_write(paddr_t addr, int len, word_t data) {
+  replay_mmio(addr, len, data, true);
 }
 
 __EXPORT void difftest_exec(uint64_t n) {
-  assert(0);
+  cpu_exec_ref(n);
+  Assert(mmio_replay_head == mmio_replay_tail,
+      "DUT accesses device at " FMT_PADDR ", but REF does not before pc = " FMT_WORD,
+      mmio_replay[mmio_replay_head].addr, cpu.pc);
+  mmio_replay_head = mmio_replay_tail = 0;
 }
 
 __EXPORT void difftest_raise_intr(word_t NO) {
-  assert(0);
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
 }
 
 __EXPORT void difftest_init(int port) {
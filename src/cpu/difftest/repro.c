@@ -0,0 +1,146 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/difftest.h>
+#include <cpu/input.h>
+#include <memory/paddr.h>
+
+#ifdef CONFIG_DIFFTEST_REPRO
+
+/* A repro is the latest checkpoint taken before difftest fails, together
+ * with the device inputs after the checkpoint, which are kept in the log
+ * of src/cpu/input.c. Replaying the device inputs makes the execution from
+ * the checkpoint deterministic, so the failure is reproduced by running
+ * `nr_inst' instructions, without running the whole program with difftest
+ * again.
+ *
+ * Only the pages written since the last checkpoint are copied into the
+ * checkpoint, they are marked by `repro_pmem_write()' for the stores of the
+ * guest and by `difftest_sync_mem()' for DMA.
+ */
+
+#define REPRO_MAGIC "NEMURPR2"
+
+typedef struct {
+  char magic[8];
+  uint64_t nr_inst;   // number of instructions to reach the failure
+  uint32_t cpu_size;
+  uint32_t msize;
+} ReproHeader;       // followed by the CPU, the memory and the device inputs
+
+extern uint64_t g_nr_guest_inst;
+
+static CPU_state ckpt_cpu;
+static uint8_t *ckpt_mem = NULL;
+static uint64_t ckpt_inst = 0, ckpt_input = 0;
+static bool has_ckpt = false;
+static bool replaying = false;
+uint8_t repro_dirty[REPRO_NR_PAGE / 8] = {};
+
+// `full' copies the whole memory, when it may be written without marking the pages
+void repro_checkpoint(bool full) {
+  if (replaying) return;
+  if (ckpt_mem == NULL) {
+    ckpt_mem = malloc(CONFIG_MSIZE);
+    assert(ckpt_mem);
+  }
+  ckpt_cpu = cpu;
+  if (full || !has_ckpt) {
+    memcpy(ckpt_mem, guest_to_host(CONFIG_MBASE), CONFIG_MSIZE);
+  } else {
+    for (uint32_t i = 0; i < REPRO_NR_PAGE / 8; i ++) {
+      if (repro_dirty[i] == 0) continue;
+      for (uint32_t p = i * 8; p < i * 8 + 8; p ++) {
+        if (repro_dirty[i] >> (p % 8) & 1) {
+          memcpy(ckpt_mem + (p << PAGE_SHIFT), guest_to_host(CONFIG_MBASE + (p << PAGE_SHIFT)), PAGE_SIZE);
+        }
+      }
+    }
+  }
+  memset(repro_dirty, 0, sizeof(repro_dirty));
+  ckpt_inst = g_nr_guest_inst;
+  ckpt_input = input_pos();
+  input_keep(ckpt_input);
+  has_ckpt = true;
+}
+
+void repro_invalidate() {
+  has_ckpt = false;
+  input_keep(INPUT_KEEP_NONE);
+}
+
+void repro_step() {
+  if (has_ckpt && g_nr_guest_inst - ckpt_inst >= CONFIG_DIFFTEST_REPRO_INTERVAL) {
+    repro_checkpoint(false);
+  }
+}
+
+void repro_dump() {
+  if (replaying) return;
+  if (!has_ckpt) {
+    Log("No checkpoint is available since difftest was detached, repro is not generated");
+    return;
+  }
+  const char *file = CONFIG_DIFFTEST_REPRO_FILE;
+  FILE *fp = fopen(file, "wb");
+  if (fp == NULL) {
+    Log("Can not open '%s' to write the repro", file);
+    return;
+  }
+  ReproHeader h = { .nr_inst = g_nr_guest_inst - ckpt_inst,
+    .cpu_size = sizeof(CPU_state), .msize = CONFIG_MSIZE };
+  memcpy(h.magic, REPRO_MAGIC, sizeof(h.magic));
+  int64_t nr_input = -1;
+  if (fwrite(&h, sizeof(h), 1, fp) == 1 &&
+      fwrite(&ckpt_cpu, sizeof(ckpt_cpu), 1, fp) == 1 &&
+      fwrite(ckpt_mem, CONFIG_MSIZE, 1, fp) == 1) {
+    nr_input = input_save(fp, ckpt_input, ckpt_inst);
+  }
+  fclose(fp);
+  if (nr_input < 0) {
+    Log("Fail to write the repro to '%s'", file);
+    return;
+  }
+  Log("Repro is written to '%s': checkpoint at instruction %" PRIu64
+      ", failure after %" PRIu64 " instructions, %" PRId64 " device input(s)",
+      file, ckpt_inst, h.nr_inst, nr_input);
+  Log("Reproduce it with --repro=%s and `si %" PRIu64 "'", file, h.nr_inst);
+}
+
+void repro_load(const char *file) {
+  FILE *fp = fopen(file, "rb");
+  Assert(fp, "Can not open '%s'", file);
+  ReproHeader h;
+  Assert(fread(&h, sizeof(h), 1, fp) == 1 && memcmp(h.magic, REPRO_MAGIC, sizeof(h.magic)) == 0,
+      "'%s' is not a repro file", file);
+  Assert(h.cpu_size == sizeof(CPU_state) && h.msize == CONFIG_MSIZE,
+      "'%s' is generated by a NEMU with a different configuration", file);
+  bool ok = fread(&cpu, sizeof(cpu), 1, fp) == 1 &&
+    fread(guest_to_host(CONFIG_MBASE), CONFIG_MSIZE, 1, fp) == 1;
+  Assert(ok, "'%s' is truncated", file);
+  // the interrupts taken right at the checkpoint are raised by the first `cpu_exec()'
+  input_load(fp, file);
+  fclose(fp);
+
+  replaying = true;
+  has_ckpt = false;
+  difftest_load();
+  Log("Replay the repro '%s', the failure is expected after %" PRIu64 " instructions",
+      file, h.nr_inst);
+}
+
+#endif
@@ -0,0 +1,353 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/difftest.h>
+#include <cpu/input.h>
+#include <cpu/reverse.h>
+#include <memory/paddr.h>
+
+#ifdef CONFIG_INPUT_LOG
+
+/* The log of device inputs: the values of MMIO reads (RTC, keyboard
+ * scancodes, audio count, ...), the interrupts taken and the data of disk
+ * DMA, each tagged with the number of instructions executed before it.
+ * Replaying the log feeds the guest exactly the same inputs, while the
+ * host clock, the timer signal and the SDL events are ignored, so the run
+ * is deterministic. The inputs kept in memory are replayed by reverse
+ * execution from a snapshot to the present, and by a repro of difftest
+ * from its checkpoint; a record keeps the inputs of the whole run in a
+ * file, see --record and --replay.
+ */
+
+enum { IN_MMIO, IN_INTR, IN_DMA };
+
+typedef struct {
+  uint64_t inst;
+  uint64_t addr;
+  uint64_t data;  // the value read, the interrupt number, or where the DMA data is
+  uint32_t type;
+  uint32_t len;   // in a file, followed by LEN bytes of data for IN_DMA
+} InputEntry;
+
+extern uint64_t g_nr_guest_inst;
+
+// the inputs at the positions [base, base + nr_entry), the next one is at base + pos
+static InputEntry *entry = NULL;
+static uint64_t base = 0, nr_entry = 0, max_entry = 0, pos = 0;
+// the DMA data at [dma_base, dma_base + dma_size)
+static uint8_t *dma = NULL;
+static uint64_t dma_base = 0, dma_size = 0, max_dma = 0;
+static uint64_t keep_from = INPUT_KEEP_NONE;
+static uint64_t replay_end = 0;  // the inputs before this instruction are replayed
+
+#ifdef CONFIG_RECORD
+#define RECORD_MAGIC "NEMUREC1"
+
+typedef struct {
+  char magic[8];
+  char isa[16];
+  uint32_t word_size;
+  uint32_t seed;  // of rand(), which may fill the memory at start
+} RecordHeader;
+
+enum { RECORD_OFF, RECORD_ON, RECORD_REPLAY };
+static int record_mode = RECORD_OFF;
+static FILE *record_fp = NULL;
+static const char *record_file = NULL;
+static uint64_t nr_record = 0;
+static bool record_read();
+static void record_write(const InputEntry *e);
+#endif
+
+static bool replay_mode() {
+  return g_nr_guest_inst < replay_end || MUXDEF(CONFIG_RECORD, record_mode == RECORD_REPLAY, false);
+}
+
+// true if the inputs of the running guest come from the log
+bool input_replaying() {
+  return replay_mode() && nemu_state.state == NEMU_RUNNING;
+}
+
+static InputEntry* append(int type, uint64_t inst, uint64_t addr, int len, uint64_t data) {
+  if (nr_entry == max_entry) {
+    max_entry = (max_entry == 0 ? 1024 : max_entry * 2);
+    entry = realloc(entry, max_entry * sizeof(entry[0]));
+    assert(entry);
+  }
+  InputEntry *e = &entry[nr_entry ++];
+  *e = (InputEntry) { .inst = inst, .addr = addr, .data = data, .type = type, .len = len };
+  return e;
+}
+
+// the room for the DMA data of E at the end of the log
+static uint8_t* dma_alloc(InputEntry *e) {
+  if (dma_size + e->len > max_dma) {
+    while (dma_size + e->len > max_dma) max_dma = (max_dma == 0 ? 65536 : max_dma * 2);
+    dma = realloc(dma, max_dma);
+    assert(dma);
+  }
+  e->data = dma_base + dma_size;
+  dma_size += e->len;
+  return dma + (e->data - dma_base);
+}
+
+static uint8_t* dma_data(const InputEntry *e) {
+  return dma + (e->data - dma_base);
+}
+
+// the DMA data of the inputs from the index I on start here
+static uint64_t dma_from(uint64_t i) {
+  for (; i < nr_entry; i ++) {
+    if (entry[i].type == IN_DMA) return entry[i].data - dma_base;
+  }
+  return dma_size;
+}
+
+// drop the inputs which are replayed and not kept
+static void forget() {
+  uint64_t n = (keep_from < base + pos ? keep_from : base + pos) - base;
+  if (n == 0) return;
+  uint64_t d = dma_from(n);
+  memmove(entry, entry + n, sizeof(entry[0]) * (nr_entry - n));
+  memmove(dma, dma + d, dma_size - d);
+  base += n; nr_entry -= n; pos -= n;
+  dma_base += d; dma_size -= d;
+}
+
+// log an input taken from the devices
+static void put(int type, uint64_t addr, int len, uint64_t data, const void *buf) {
+  forget();
+  InputEntry *e = append(type, g_nr_guest_inst, addr, len, data);
+  if (type == IN_DMA) memcpy(dma_alloc(e), buf, len);
+  pos = nr_entry;
+  IFDEF(CONFIG_RECORD, if (record_mode == RECORD_ON) record_write(e));
+}
+
+// the next input to replay, or NULL if there is none
+static InputEntry* peek() {
+  forget();
+  if (pos < nr_entry) return &entry[pos];
+  IFDEF(CONFIG_RECORD, if (record_mode == RECORD_REPLAY && record_read()) return &entry[pos]);
+  return NULL;
+}
+
+static const char *type_name(int type) {
+  return type == IN_MMIO ? "device read" : type == IN_INTR ? "interrupt" : "disk DMA";
+}
+
+// take the next input, which is expected to be the one the guest asks for
+static InputEntry* take(int type, uint64_t addr, int len) {
+  InputEntry *e = peek();
+  Assert(e != NULL, "no more device inputs to replay at instruction %" PRIu64 ", pc = " FMT_WORD
+      ", but the guest makes a %s of %d byte(s) at %#" PRIx64, g_nr_guest_inst, cpu.pc, type_name(type), len, addr);
+  Assert(e->type == type && e->inst == g_nr_guest_inst && e->addr == addr && e->len == len,
+      "replay diverges at instruction %" PRIu64 ", pc = " FMT_WORD ": the log has a %s of %d byte(s) at %#" PRIx64
+      " at instruction %" PRIu64 ", but the guest makes a %s of %d byte(s) at %#" PRIx64,
+      g_nr_guest_inst, cpu.pc, type_name(e->type), e->len, e->addr, e->inst, type_name(type), len, addr);
+  pos ++;
+  return e;
+}
+
+word_t input_query_intr() {
+  if (!replay_mode()) {
+    word_t intr = isa_query_intr();
+    if (intr != INTR_EMPTY) put(IN_INTR, 0, 0, intr, NULL);
+    return intr;
+  }
+  // the interrupts are taken only at the logged instructions
+  isa_clear_intr();
+  InputEntry *e = peek();
+  if (e == NULL || e->type != IN_INTR || e->inst != g_nr_guest_inst) return INTR_EMPTY;
+  pos ++;
+  return e->data;
+}
+
+// a stop skips the interrupt after the instruction, take it before the next one
+void input_resume() {
+  if (!replay_mode()) return;
+  word_t intr;
+  while ((intr = input_query_intr()) != INTR_EMPTY) {
+    cpu.pc = isa_raise_intr(intr, cpu.pc);
+    difftest_intr(intr);
+  }
+}
+
+void input_mmio(paddr_t addr, int len, word_t data) {
+  // the reads of the debugger are not inputs of the guest
+  if (nemu_state.state == NEMU_RUNNING) put(IN_MMIO, addr, len, data, NULL);
+}
+
+word_t input_replay_mmio(paddr_t addr, int len) {
+  return take(IN_MMIO, addr, len)->data;
+}
+
+// called after a device writes [addr, addr + len) of pmem
+void input_dma(paddr_t addr, int len) {
+  if (nemu_state.state == NEMU_RUNNING) put(IN_DMA, addr, len, 0, guest_to_host(addr));
+}
+
+static void dma_to_guest(const InputEntry *e) {
+  IFDEF(CONFIG_REVERSE, rev_dma_write(e->addr, e->len));
+  memcpy(guest_to_host(e->addr), dma_data(e), e->len);
+}
+
+void input_replay_dma(paddr_t addr, int len) {
+  dma_to_guest(take(IN_DMA, addr, len));
+}
+
+// called by a device write the devices do not see, which may have started a DMA
+void input_redo_dma() {
+  InputEntry *e;
+  while ((e = peek()) != NULL && e->type == IN_DMA && e->inst == g_nr_guest_inst) {
+    dma_to_guest(e);
+    pos ++;
+  }
+}
+
+// the position of the next input
+uint64_t input_pos() {
+  return base + pos;
+}
+
+// keep the inputs from the position P on, so they can be replayed again
+void input_keep(uint64_t p) {
+  keep_from = p;
+  forget();
+}
+
+/* Replay the inputs from the position P, until the instruction END where
+ * the guest takes the inputs from the devices again.
+ */
+void input_seek(uint64_t p, uint64_t end) {
+  Assert(p >= base && p <= base + nr_entry, "input %" PRIu64 " is not kept", p);
+  pos = p - base;
+  replay_end = end;
+}
+
+// stop replaying, the inputs not replayed yet are dropped unless they come from a record
+void input_reset() {
+  replay_end = 0;
+  if (MUXDEF(CONFIG_RECORD, record_mode == RECORD_REPLAY, false)) return;
+  dma_size = dma_from(pos);
+  nr_entry = pos;
+}
+
+static bool write_entry(FILE *fp, const InputEntry *e, uint64_t inst) {
+  InputEntry f = *e;
+  f.inst -= inst;
+  if (f.type == IN_DMA) f.data = 0;
+  return fwrite(&f, sizeof(f), 1, fp) == 1 &&
+    (f.type != IN_DMA || fwrite(dma_data(e), f.len, 1, fp) == 1);
+}
+
+// append the next input in FP to the log, false at the end of the file
+static bool read_entry(FILE *fp, uint64_t inst, const char *file) {
+  InputEntry f;
+  if (fread(&f, sizeof(f), 1, fp) != 1) return false;
+  InputEntry *e = append(f.type, f.inst + inst, f.addr, f.len, f.data);
+  if (f.type == IN_DMA) Assert(fread(dma_alloc(e), f.len, 1, fp) == 1, "'%s' is truncated", file);
+  return true;
+}
+
+/* Write the inputs from the position P on to FP, with the instruction
+ * counts relative to INST. Return the number of inputs written, or -1
+ * if the writing fails.
+ */
+int64_t input_save(FILE *fp, uint64_t p, uint64_t inst) {
+  for (uint64_t i = p - base; i < nr_entry; i ++) {
+    if (!write_entry(fp, &entry[i], inst)) return -1;
+  }
+  return nr_entry - (p - base);
+}
+
+// replay the inputs in the rest of FP, with the instruction counts relative to now
+void input_load(FILE *fp, const char *file) {
+  input_reset();
+  uint64_t p = input_pos();
+  while (read_entry(fp, g_nr_guest_inst, file));
+  input_seek(p, UINT64_MAX);
+}
+
+#ifdef CONFIG_RECORD
+static void record_close() {
+  if (record_fp == NULL) return;
+  if (record_mode == RECORD_ON) {
+    Log("%" PRIu64 " device input(s) are recorded to %s", nr_record, record_file);
+  }
+  // the interrupt raised by the devices during the replay is stale
+  if (record_mode == RECORD_REPLAY) isa_clear_intr();
+  fclose(record_fp);
+  record_fp = NULL;
+  record_mode = RECORD_OFF;
+}
+
+// keep the record when NEMU fails an assertion
+void record_flush() {
+  if (record_fp != NULL && record_mode == RECORD_ON) fflush(record_fp);
+}
+
+static void record_write(const InputEntry *e) {
+  write_entry(record_fp, e, 0);
+  nr_record ++;
+}
+
+// the inputs of the record are read one at a time, the devices are used after the last one
+static bool record_read() {
+  if (read_entry(record_fp, 0, record_file)) {
+    nr_record ++;
+    return true;
+  }
+  Log("Replay reaches the end of %s at instruction %" PRIu64 " after %" PRIu64
+      " input(s), the real devices are used from now on", record_file, g_nr_guest_inst, nr_record);
+  record_close();
+  return false;
+}
+
+void record_open(const char *f) {
+  record_file = f;
+  record_fp = fopen(record_file, "wb");
+  Assert(record_fp, "Can not open '%s'", record_file);
+  setvbuf(record_fp, NULL, _IOFBF, 1 << 20);
+  RecordHeader h = { .word_size = sizeof(word_t), .seed = rand() };
+  memcpy(h.magic, RECORD_MAGIC, sizeof(h.magic));
+  strncpy(h.isa, CONFIG_ISA, sizeof(h.isa) - 1);
+  fwrite(&h, sizeof(h), 1, record_fp);
+  srand(h.seed);
+  record_mode = RECORD_ON;
+  atexit(record_close);
+  Log("Device inputs are recorded to %s", record_file);
+}
+
+void replay_open(const char *f) {
+  record_file = f;
+  record_fp = fopen(record_file, "rb");
+  Assert(record_fp, "Can not open '%s'", record_file);
+  setvbuf(record_fp, NULL, _IOFBF, 1 << 20);
+  RecordHeader h;
+  Assert(fread(&h, sizeof(h), 1, record_fp) == 1 && memcmp(h.magic, RECORD_MAGIC, sizeof(h.magic)) == 0,
+      "'%s' is not a record file", record_file);
+  Assert(strcmp(h.isa, CONFIG_ISA) == 0 && h.word_size == sizeof(word_t),
+      "'%s' is recorded by %s-NEMU", record_file, h.isa);
+  srand(h.seed);
+  record_mode = RECORD_REPLAY;
+  atexit(record_close);
+  Log("Replay the device inputs recorded in %s", record_file);
+}
+#endif
+
+#endif
@@ -0,0 +1,219 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/input.h>
+#include <cpu/reverse.h>
+#include <memory/paddr.h>
+#include <monitor/sdb.h>
+
+#ifdef CONFIG_REVERSE
+
+/* Reverse execution restores a snapshot before the target and replays
+ * the guest to it. A snapshot is taken every CONFIG_REVERSE_INTERVAL
+ * instructions, and only keeps the pages stored to before the next one:
+ * a page is saved by the first store to it after the snapshot, so the
+ * memory at a snapshot is recovered by undoing the newer snapshots.
+ * The device inputs since the oldest snapshot are kept in the log of
+ * src/cpu/input.c, so the replay is deterministic and does not touch the
+ * devices until it reaches the present, the furthest point the guest has
+ * run to.
+ */
+
+typedef struct {
+  uint32_t page;
+  uint8_t data[PAGE_SIZE];
+} UndoPage;
+
+typedef struct {
+  CPU_state cpu;
+  uint64_t inst;
+  uint64_t input_pos;           // the device inputs after the snapshot
+  UndoPage **undo;              // the pages at the snapshot, stored to after it
+  int nr_undo, max_undo;
+} Snapshot;
+
+extern uint64_t g_nr_guest_inst;
+
+uint64_t rev_next = 0;
+bool rev_replaying = false;
+uint8_t rev_saved[REV_NR_PAGE / 8] = {};
+
+static Snapshot snap[CONFIG_REVERSE_NR_SNAPSHOT];
+static int nr_snap = 0;
+static uint64_t present = 0;
+static CPU_state present_cpu;
+
+static void free_undo(Snapshot *s, bool apply) {
+  for (int i = s->nr_undo - 1; i >= 0; i --) {
+    if (apply) memcpy(guest_to_host(CONFIG_MBASE + s->undo[i]->page * PAGE_SIZE), s->undo[i]->data, PAGE_SIZE);
+    free(s->undo[i]);
+  }
+  free(s->undo);
+  s->undo = NULL;
+  s->nr_undo = s->max_undo = 0;
+}
+
+static void update_next() {
+  rev_next = snap[nr_snap - 1].inst + CONFIG_REVERSE_INTERVAL;
+  if (rev_replaying && present < rev_next) rev_next = present;
+}
+
+static void take_snapshot() {
+  if (nr_snap == CONFIG_REVERSE_NR_SNAPSHOT) {
+    // forget the oldest snapshot
+    free_undo(&snap[0], false);
+    memmove(snap, snap + 1, sizeof(snap[0]) * (-- nr_snap));
+  }
+  snap[nr_snap ++] = (Snapshot) { .cpu = cpu, .inst = g_nr_guest_inst, .input_pos = input_pos() };
+  // the device inputs before the oldest snapshot are not replayed any more
+  input_keep(snap[0].input_pos);
+  memset(rev_saved, 0, sizeof(rev_saved));
+}
+
+void rev_save_page(uint32_t page) {
+  if (nr_snap == 0) return;
+  Snapshot *s = &snap[nr_snap - 1];
+  if (s->nr_undo == s->max_undo) {
+    s->max_undo = (s->max_undo == 0 ? 64 : s->max_undo * 2);
+    s->undo = realloc(s->undo, s->max_undo * sizeof(s->undo[0]));
+    assert(s->undo);
+  }
+  UndoPage *u = malloc(sizeof(UndoPage));
+  assert(u);
+  u->page = page;
+  memcpy(u->data, guest_to_host(CONFIG_MBASE + page * PAGE_SIZE), PAGE_SIZE);
+  s->undo[s->nr_undo ++] = u;
+  rev_saved[page / 8] |= 1 << (page % 8);
+}
+
+void rev_event() {
+  if (rev_replaying && g_nr_guest_inst == present) {
+    if (cpu.pc != present_cpu.pc) {
+      Log("replay diverges: pc = " FMT_WORD ", but " FMT_WORD " is expected", cpu.pc, present_cpu.pc);
+    }
+    // the interrupt raised by the devices during the replayed instructions is pending
+    cpu = present_cpu;
+    rev_replaying = false;
+  }
+  if (nr_snap == 0 || g_nr_guest_inst >= snap[nr_snap - 1].inst + CONFIG_REVERSE_INTERVAL) take_snapshot();
+  update_next();
+}
+
+// called before a device writes [addr, addr + len) of pmem
+void rev_dma_write(paddr_t addr, int len) {
+  for (uint32_t p = (addr - CONFIG_MBASE) >> PAGE_SHIFT; p <= (addr + len - 1 - CONFIG_MBASE) >> PAGE_SHIFT && p < REV_NR_PAGE; p ++) {
+    if (!(rev_saved[p / 8] >> (p % 8) & 1)) rev_save_page(p);
+  }
+}
+
+// forget the history, e.g. when the guest state is changed by the debugger
+void rev_reset() {
+  for (int i = 0; i < nr_snap; i ++) free_undo(&snap[i], false);
+  nr_snap = 0;
+  input_reset();
+  input_keep(INPUT_KEEP_NONE);
+  rev_replaying = false;
+  rev_next = 0;
+  memset(rev_saved, 0, sizeof(rev_saved));
+}
+
+// the number of instructions executed up to the present
+uint64_t rev_present_inst() {
+  return rev_replaying ? present : g_nr_guest_inst;
+}
+
+static void restore(int k) {
+  if (!rev_replaying) {
+    present = g_nr_guest_inst;
+    present_cpu = cpu;
+    rev_replaying = true;
+  }
+  for (int i = nr_snap - 1; i >= k; i --) free_undo(&snap[i], true);
+  nr_snap = k + 1;
+  memset(rev_saved, 0, sizeof(rev_saved));
+  cpu = snap[k].cpu;
+  g_nr_guest_inst = snap[k].inst;
+  input_seek(snap[k].input_pos, present);
+  nemu_state.state = NEMU_STOP;
+  update_next();
+  IFDEF(CONFIG_WATCHPOINT, wp_resync());
+}
+
+/* Run the guest to the instruction TARGET without stopping at the points.
+ * Return the last instruction a point fires at, or 0 if none does.
+ */
+static uint64_t replay_to(uint64_t target, PointStop *last) {
+  uint64_t hit = 0;
+  point_quiet = true;
+  while (g_nr_guest_inst < target && nemu_state.state == NEMU_STOP) {
+    point_stop.type = STOP_NONE;
+    cpu_exec_ref(target - g_nr_guest_inst);
+    if (point_stop.type != STOP_NONE) {
+      hit = g_nr_guest_inst;
+      if (last != NULL) *last = point_stop;
+    }
+  }
+  point_quiet = false;
+  return hit;
+}
+
+static bool can_reverse() {
+  return nr_snap > 0 && nemu_state.state != NEMU_QUIT;
+}
+
+// go back N instructions, return 0 if the history starts later, -1 if there is no history
+int rev_stepi(uint64_t n) {
+  if (!can_reverse()) return -1;
+  uint64_t target = (n < g_nr_guest_inst ? g_nr_guest_inst - n : 0);
+  bool ok = (target >= snap[0].inst);
+  if (!ok) target = snap[0].inst;
+  int k = nr_snap - 1;
+  while (snap[k].inst > target) k --;
+  restore(k);
+  replay_to(target, NULL);
+  point_stop.type = STOP_NONE;
+  return ok;
+}
+
+/* Go back to the last instruction a breakpoint or a watchpoint fires at,
+ * return 0 if there is none in the history, -1 if there is no history.
+ * Every interval is replayed from its snapshot, from the newest one to
+ * the oldest one.
+ */
+int rev_continue() {
+  if (!can_reverse()) return -1;
+  uint64_t end = g_nr_guest_inst;  // look for the points before it
+  for (int k = nr_snap - 1; k >= 0; k --) {
+    if (snap[k].inst >= end) continue;
+    restore(k);
+    PointStop stop;
+    uint64_t hit = replay_to(end - 1, &stop);
+    if (hit != 0) {
+      restore(k);
+      replay_to(hit, NULL);
+      point_stop = stop;
+      return 1;
+    }
+    end = snap[k].inst + 1;
+  }
+  restore(0);
+  point_stop.type = STOP_NONE;
+  return 0;
+}
+
+#endif
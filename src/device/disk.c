@@ -15,6 +15,8 @@
 
 #include <device/map.h>
 #include <memory/paddr.h>
+#include <cpu/input.h>
+#include <cpu/reverse.h>
 
 enum {
   reg_disk_present,
@@ -33,13 +35,27 @@ static uint32_t *disk_base = NULL;
 static FILE *fp = NULL;
 
 void do_disk_io() {
+  paddr_t buf = disk_base[reg_disk_io_buf];
+  size_t len = disk_base[reg_disk_io_blkcnt] * BLKSZ;
+#ifdef CONFIG_INPUT_LOG
+  // the replay takes the data from the log of device inputs, and does not change the disk image
+  if (input_replaying()) {
+    if (disk_base[reg_disk_io_cmd] == 1) {
+      input_replay_dma(buf, len);
+      difftest_sync_mem(buf, len);
+    }
+    return;
+  }
+#endif
   if (fp) {
     fseek(fp, disk_base[reg_disk_io_blkno] * BLKSZ, SEEK_SET);
-    void *host_addr = guest_to_host(disk_base[reg_disk_io_buf]);
-    size_t len = disk_base[reg_disk_io_blkcnt] * BLKSZ;
+    void *host_addr = guest_to_host(buf);
     int ret;
     if (disk_base[reg_disk_io_cmd] == 1) {
+      IFDEF(CONFIG_REVERSE, rev_dma_write(buf, len));
       ret = fread(host_addr, len, 1, fp);
+      IFDEF(CONFIG_INPUT_LOG, input_dma(buf, len));
+      difftest_sync_mem(buf, len);
     } else if (disk_base[reg_disk_io_cmd] == 2) {
       ret = fwrite(host_addr, len, 1, fp);
     } else {
@@ -59,6 +59,8 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
   IFDEF(CONFIG_DTRACE, log_write("[dtrace] read %d byte(s) from %s, offset = %d, value = %u\n", len, map->name, offset, ret));
+  btrace(dev, TRACE_READ, len, addr, ret, offset);
+  IFDEF(CONFIG_ISTAT, istat_device(map->name, false));
   return ret;
 }
 
@@ -69,4 +71,6 @@ void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
   IFDEF(CONFIG_DTRACE, log_write("[dtrace] write %d byte(s) to %s, offset = %d, value = %u\n", len, map->name, offset, data));
+  btrace(dev, TRACE_WRITE, len, addr, data, offset);
+  IFDEF(CONFIG_ISTAT, istat_device(map->name, true));
 }
@@ -15,6 +15,8 @@
 
 #include <device/map.h>
 #include <memory/paddr.h>
+#include <cpu/input.h>
+#include <cpu/reverse.h>
 
 #define NR_MAP 16
 
@@ -53,11 +55,29 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
   nr_map ++;
 }
 
+/* debugger interface, the space is accessed without the callback of the device */
+uint8_t* mmio_to_host(paddr_t addr, paddr_t *high) {
+  IOMap *map = fetch_mmio_map(addr);
+  if (map == NULL || map->space == NULL) return NULL;
+  *high = map->high;
+  return (uint8_t *)map->space + (addr - map->low);
+}
+
 /* bus interface */
 word_t mmio_read(paddr_t addr, int len) {
-  return map_read(addr, len, fetch_mmio_map(addr));
+  word_t data;
+  if (MUXDEF(CONFIG_INPUT_LOG, input_replaying(), false)) data = input_replay_mmio(addr, len);
+  else {
+    data = map_read(addr, len, fetch_mmio_map(addr));
+    IFDEF(CONFIG_INPUT_LOG, input_mmio(addr, len, data));
+  }
+  difftest_mmio_access(addr, len, data, false);
+  return data;
 }
 
 void mmio_write(paddr_t addr, int len, word_t data) {
-  map_write(addr, len, data, fetch_mmio_map(addr));
+  // the devices have seen the writes of the replayed instructions, only the DMA is done again
+  if (!MUXDEF(CONFIG_REVERSE, rev_replay_device(), false)) map_write(addr, len, data, fetch_mmio_map(addr));
+  else IFDEF(CONFIG_INPUT_LOG, input_redo_dma());
+  difftest_mmio_access(addr, len, data, true);
 }
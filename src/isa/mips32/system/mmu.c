@@ -20,3 +20,7 @@
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
   return MEM_RET_FAIL;
 }
+
+bool isa_mmu_debug_translate(vaddr_t vaddr, paddr_t *paddr) {
+  return false;
+}
@@ -19,6 +19,28 @@
 #include <memory/paddr.h>
 #include <cpu/cpu.h>
 
+// CSRs compared after every instruction when REF supports
+// `difftest_statecpy()', bit i stands for cpu.csr[i]
+#define DIFFTEST_CSR_MASK BITMASK(NR_CSR)
+static_assert(NR_CSR <= DIFFTEST_MAX_CSR, "too many CSRs for difftest_state_t");
+
+static bool checkstate(vaddr_t pc) {
+  difftest_state_t ref_s = { .csr_mask = DIFFTEST_CSR_MASK };
+  ref_difftest_statecpy(&ref_s, DIFFTEST_TO_DUT);
+  bool result = true;
+  for (int i = 0; i < NR_CSR; i++) {
+    if ((DIFFTEST_CSR_MASK & (1u << i)) && cpu.csr[i] != ref_s.csr[i]) {
+      printf("difftest failed, %s ref: " FMT_WORD ", dut: " FMT_WORD "\n", csr_name[i], ref_s.csr[i], cpu.csr[i]);
+      result = false;
+    }
+  }
+  if (cpu.mode != (int)ref_s.mode) {
+    printf("difftest failed, privilege ref: %d, dut: %d\n", (int)ref_s.mode, cpu.mode);
+    result = false;
+  }
+  return result;
+}
+
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
   bool result = true;
   if (cpu.pc != ref_r->pc) {
@@ -31,10 +53,19 @@ bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
       result = false;
     }
   }
+  if (ref_difftest_statecpy != NULL && !checkstate(pc)) result = false;
   return result;
 }
 
 void isa_difftest_attach() {
+  if (ref_difftest_statecpy != NULL) {
+    difftest_state_t s = { .csr_mask = BITMASK(NR_CSR), .mode = cpu.mode };
+    memcpy(s.csr, cpu.csr, sizeof(cpu.csr));
+    ref_difftest_statecpy(&s, DIFFTEST_TO_REF);
+    return;
+  }
+  // REF can only access CSRs by executing instructions,
+  // so write them one by one with `csrrw x0, csr, x1'
   const word_t R = 1;
   vaddr_t saved_pc = cpu.pc;
   word_t saved_reg = cpu.gpr[R];
@@ -0,0 +1,29 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <difftest-def.h>
+#include "../local-include/reg.h"
+
+// see src/cpu/difftest/ref.c for the common part of the REF API
+__EXPORT void difftest_statecpy(difftest_state_t *s, bool direction) {
+  for (int i = 0; i < NR_CSR; i ++) {
+    if (!(s->csr_mask & (1u << i))) continue;
+    if (direction == DIFFTEST_TO_REF) cpu.csr[i] = s->csr[i];
+    else s->csr[i] = cpu.csr[i];
+  }
+  if (direction == DIFFTEST_TO_REF) cpu.mode = s->mode;
+  else s->mode = cpu.mode;
+}
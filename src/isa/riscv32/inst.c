@@ -62,18 +62,24 @@ static int decode_exec(Decode *s) {
   word_t src1 = 0, src2 = 0, imm = 0; \
   decode_operand(s, &rd, &rs1, &rs2, &src1, &src2, &imm, concat(TYPE_, type)); \
   __VA_ARGS__ ; \
+  IFDEF(CONFIG_ISTAT, if (concat(TYPE_, type) == TYPE_B) istat_count(istat_branch[s->dnpc != s->snpc])); \
 }
 
 // jal jalr
 #define FUNCTION_TRACE_CALL() { \
   IFDEF(CONFIG_FTRACE, if (rd == 1) { add_function_trace(s->pc, s->dnpc, FUNCTION_CALL); }) \
+  if (rd == 1) { btrace(func, TRACE_CALL, 0, s->pc, s->dnpc, 0); } \
 }
 
 // jalr
 #define FUNCTION_TRACE_RET() { \
   IFDEF(CONFIG_FTRACE, if (rd == 0 && rs1 == 1 && imm == 0) { add_function_trace(s->pc, s->dnpc, FUNCTION_RETURN); }) \
+  if (rd == 0 && rs1 == 1 && imm == 0) { btrace(func, TRACE_RET, 0, s->pc, s->dnpc, 0); } \
 }
 
+// csr instructions, `val' is rs1 or uimm
+#define CSR_BTRACE(val) btrace(csr, BITS(s->isa.inst, 14, 12), 0, s->pc, imm & 0xfff, val)
+
   INSTPAT_START();
 
   INSTPAT("0000000 ????? ????? 000 ????? 01100 11", add  , R, R(rd) = src1 + src2);
@@ -133,12 +139,12 @@ static int decode_exec(Decode *s) {
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
   INSTPAT("0011000 00010 00000 000 00000 11100 11", mret ,   N, s->dnpc = isa_intr_ret());
 
-  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw ,  I, IFDEF(CONFIG_CSR_TRACE, Log("csrrw %#x, rs %d, src 0x%08x, rd %d", imm, rs1, src1, rd)); R(rd) = cpu.csr[csr_addr_map[imm]]; cpu.csr[csr_addr_map[imm]] = src1);
-  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs ,  I, IFDEF(CONFIG_CSR_TRACE, Log("csrrs %#x, rs %d, src 0x%08x, rd %d", imm, rs1, src1, rd)); R(rd) = cpu.csr[csr_addr_map[imm]]; cpu.csr[csr_addr_map[imm]] |= src1);
-  INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc ,  I, IFDEF(CONFIG_CSR_TRACE, Log("csrrc %#x, rs %d, src 0x%08x, rd %d", imm, rs1, src1, rd)); R(rd) = cpu.csr[csr_addr_map[imm]]; cpu.csr[csr_addr_map[imm]] &= ~src1);
-  INSTPAT("??????? ????? ????? 101 ????? 11100 11", csrrwi , I, IFDEF(CONFIG_CSR_TRACE, Log("csrrwi %#x, uimm 0x%08x, rd %d", imm, rs1, rd)); R(rd) = cpu.csr[csr_addr_map[imm]]; cpu.csr[csr_addr_map[imm]] = (uint32_t)rs1);
-  INSTPAT("??????? ????? ????? 110 ????? 11100 11", csrrsi , I, IFDEF(CONFIG_CSR_TRACE, Log("csrrsi %#x, uimm 0x%08x, rd %d", imm, rs1, rd)); R(rd) = cpu.csr[csr_addr_map[imm]]; cpu.csr[csr_addr_map[imm]] |= (uint32_t)rs1);
-  INSTPAT("??????? ????? ????? 111 ????? 11100 11", csrrci , I, IFDEF(CONFIG_CSR_TRACE, Log("csrrci %#x, uimm 0x%08x, rd %d", imm, rs1, rd)); R(rd) = cpu.csr[csr_addr_map[imm]]; cpu.csr[csr_addr_map[imm]] &= ~(uint32_t)rs1);
+  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw ,  I, IFDEF(CONFIG_CSR_TRACE, Log("csrrw %#x, rs %d, src 0x%08x, rd %d", imm, rs1, src1, rd)); CSR_BTRACE(src1); R(rd) = cpu.csr[csr_addr_map[imm]]; cpu.csr[csr_addr_map[imm]] = src1);
+  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs ,  I, IFDEF(CONFIG_CSR_TRACE, Log("csrrs %#x, rs %d, src 0x%08x, rd %d", imm, rs1, src1, rd)); CSR_BTRACE(src1); R(rd) = cpu.csr[csr_addr_map[imm]]; cpu.csr[csr_addr_map[imm]] |= src1);
+  INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc ,  I, IFDEF(CONFIG_CSR_TRACE, Log("csrrc %#x, rs %d, src 0x%08x, rd %d", imm, rs1, src1, rd)); CSR_BTRACE(src1); R(rd) = cpu.csr[csr_addr_map[imm]]; cpu.csr[csr_addr_map[imm]] &= ~src1);
+  INSTPAT("??????? ????? ????? 101 ????? 11100 11", csrrwi , I, IFDEF(CONFIG_CSR_TRACE, Log("csrrwi %#x, uimm 0x%08x, rd %d", imm, rs1, rd)); CSR_BTRACE(rs1); R(rd) = cpu.csr[csr_addr_map[imm]]; cpu.csr[csr_addr_map[imm]] = (uint32_t)rs1);
+  INSTPAT("??????? ????? ????? 110 ????? 11100 11", csrrsi , I, IFDEF(CONFIG_CSR_TRACE, Log("csrrsi %#x, uimm 0x%08x, rd %d", imm, rs1, rd)); CSR_BTRACE(rs1); R(rd) = cpu.csr[csr_addr_map[imm]]; cpu.csr[csr_addr_map[imm]] |= (uint32_t)rs1);
+  INSTPAT("??????? ????? ????? 111 ????? 11100 11", csrrci , I, IFDEF(CONFIG_CSR_TRACE, Log("csrrci %#x, uimm 0x%08x, rd %d", imm, rs1, rd)); CSR_BTRACE(rs1); R(rd) = cpu.csr[csr_addr_map[imm]]; cpu.csr[csr_addr_map[imm]] &= ~(uint32_t)rs1);
 
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
 
@@ -29,6 +29,7 @@ enum {
 };
 
 extern const word_t csr_addr[NR_CSR];
+extern const char *csr_name[NR_CSR];
 extern int csr_addr_map[];
 void init_csr_addr_map();
 
@@ -70,3 +70,16 @@ word_t isa_reg_str2val(const char *s, bool *success) {
   }
   return 0;
 }
+
+// the register can be read through the pointer, NULL if it does not exist
+word_t *isa_reg_str2ptr(const char *s) {
+  if (s == NULL) return NULL;
+  for (int idx = 0; idx < RISCV_GPR_NUM; idx++) {
+    if (strcmp(s, regs[idx]) == 0) return &gpr(idx);
+  }
+  if (strcmp(s, "pc") == 0) return &cpu.pc;
+  for (int idx = 0; idx < NR_CSR; idx++) {
+    if (strcmp(s, csr_name[idx]) == 0) return &cpu.csr[idx];
+  }
+  return NULL;
+}
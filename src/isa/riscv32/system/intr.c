@@ -22,6 +22,8 @@ word_t isa_raise_intr(word_t NO, vaddr_t epc) {
    * Then return the address of the interrupt/exception vector.
    */
   IFDEF(CONFIG_ETRACE, log_write("[etrace] interrupt from pc " FMT_PADDR ", mcause: " FMT_WORD "\n", epc, NO));
+  btrace(exc, 0, 0, epc, NO, cpu.csr[CSR_mtvec]);
+  IFDEF(CONFIG_ISTAT, istat_trap(NO));
   cpu.csr[CSR_mepc] = epc;
   cpu.csr[CSR_mcause] = NO;
   // set mstatus.MPP to cpu.mode and enter M mode
@@ -43,6 +45,10 @@ word_t isa_query_intr() {
   return INTR_EMPTY;
 }
 
+void isa_clear_intr() {
+  cpu.INTR = false;
+}
+
 vaddr_t isa_intr_ret() {
   // recover mode from mstatus.MPP and set mstatus.MPP to U
   cpu.mode = (cpu.csr[CSR_mstatus] >> 11) & 0x3;
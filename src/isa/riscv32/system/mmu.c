@@ -53,3 +53,19 @@ paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
   paddr_t paddr = page_addr | (vaddr & PAGE_MASK);
   return paddr;
 }
+
+/* Walk the page table for the debugger. Unlike isa_mmu_translate(),
+ * the page table is read without tracing, and an unmapped address
+ * returns false instead of aborting.
+ */
+bool isa_mmu_debug_translate(vaddr_t vaddr, paddr_t *paddr) {
+  word_t page_dir_entry, page_table_entry;
+  paddr_t page_dir_addr = cpu.csr[CSR_satp] << 12;
+  if (!paddr_peek(page_dir_addr + sizeof(uint32_t) * (vaddr >> 22), 4, &page_dir_entry) ||
+      (page_dir_entry & 0xf) != 0x1) return false;
+  paddr_t page_table_addr = page_dir_entry >> 10 << 12;
+  if (!paddr_peek(page_table_addr + sizeof(uint32_t) * ((vaddr >> 12) & ((1 << 10) - 1)), 4, &page_table_entry) ||
+      (page_table_entry & 0x1) == 0) return false;
+  *paddr = (page_table_entry >> 10 << 12) | (vaddr & PAGE_MASK);
+  return true;
+}
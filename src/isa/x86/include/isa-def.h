@@ -18,36 +18,54 @@
 
 #include <common.h>
 
-
-/* TODO: Re-organize the `CPU_state' structure to match the register
- * encoding scheme in i386 instruction format. For example, if we
- * access cpu.gpr[3]._16, we will get the `bx' register; if we access
- * cpu.gpr[1]._8[1], we will get the 'ch' register. Hint: Use `union'.
- * For more details about the register encoding scheme, see i386 manual.
- */
-
 typedef struct {
-  struct {
-    uint32_t _32;
-    uint16_t _16;
-    uint8_t _8[2];
-  } gpr[8];
+  union {
+    union {
+      uint32_t _32;
+      uint16_t _16;
+      uint8_t _8[2];
+    } gpr[8];
 
-  /* Do NOT change the order of the GPRs' definitions. */
-  uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    /* Do NOT change the order of the GPRs' definitions. */
+    struct {
+      uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    };
+  };
 
   vaddr_t pc;
+
+  uint32_t cr0, cr2, cr3, cr4;
+
+  /* Segment registers. The base and limit are cached from the descriptor
+   * when the selector is loaded, as the hidden part of the register. */
+  struct {
+    uint16_t sel;
+    uint32_t base, limit;
+  } sreg[6];
+  struct {
+    uint16_t limit;
+    uint32_t base;
+  } gdtr;
+  bool seg_flat; // all segments in use have base 0 and 4GB limit
+
+  bool INTR;
 } x86_CPU_state;
 
 // decode
 typedef struct {
   uint8_t inst[16];
   uint8_t *p_inst;
+  int sreg; // segment of the memory operand, -1 for the default one
 } x86_ISADecodeInfo;
 
 enum { R_EAX, R_ECX, R_EDX, R_EBX, R_ESP, R_EBP, R_ESI, R_EDI };
 enum { R_AX, R_CX, R_DX, R_BX, R_SP, R_BP, R_SI, R_DI };
 enum { R_AL, R_CL, R_DL, R_BL, R_AH, R_CH, R_DH, R_BH };
+enum { R_ES, R_CS, R_SS, R_DS, R_FS, R_GS };
+
+#define CR0_PE  0x00000001u
+#define CR0_PG  0x80000000u
+#define CR4_PSE 0x00000010u
 
-#define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
+#define isa_mmu_check(vaddr, len, type) ((cpu.cr0 & CR0_PG) ? MMU_TRANSLATE : MMU_DIRECT)
 #endif
@@ -16,6 +16,7 @@
 #include <isa.h>
 #include <memory/paddr.h>
 #include "local-include/reg.h"
+#include "local-include/mmu.h"
 
 static const uint8_t img []  = {
   0xb8, 0x34, 0x12, 0x00, 0x00,        // 100000:  movl  $0x1234,%eax
@@ -32,6 +33,10 @@ static const uint8_t img []  = {
 static void restart() {
   /* Set the initial instruction pointer. */
   cpu.pc = RESET_VECTOR;
+
+  /* Start in protected mode with flat segments and paging disabled. */
+  cpu.cr0 = CR0_PE;
+  init_seg();
 }
 
 void init_isa() {
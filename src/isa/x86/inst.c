@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #include "local-include/reg.h"
+#include "local-include/mmu.h"
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
@@ -40,10 +41,17 @@ typedef union {
   uint8_t val;
 } SIB;
 
+static inline word_t x86_ifetch(vaddr_t *pc, int len) {
+  if (likely(cpu.seg_flat)) return inst_fetch(pc, len);
+  word_t inst = vaddr_ifetch(seg_translate(R_CS, *pc, len), len);
+  (*pc) += len;
+  return inst;
+}
+
 static word_t x86_inst_fetch(Decode *s, int len) {
 #if defined(CONFIG_ITRACE) || defined(CONFIG_IQUEUE)
   uint8_t *p = &s->isa.inst[s->snpc - s->pc];
-  word_t ret = inst_fetch(&s->snpc, len);
+  word_t ret = x86_ifetch(&s->snpc, len);
   word_t ret_save = ret;
   int i;
   assert(s->snpc - s->pc < sizeof(s->isa.inst));
@@ -53,7 +61,7 @@ static word_t x86_inst_fetch(Decode *s, int len) {
   }
   return ret_save;
 #else
-  return inst_fetch(&s->snpc, len);
+  return x86_ifetch(&s->snpc, len);
 #endif
 }
 
@@ -103,6 +111,9 @@ static void load_addr(Decode *s, ModR_M *m, word_t *rm_addr) {
     if (disp_size == 1) { disp = (int8_t)disp; }
   }
 
+  // stack accesses use SS by default
+  if (s->isa.sreg == -1 && (base_reg == R_ESP || base_reg == R_EBP)) { s->isa.sreg = R_SS; }
+
   word_t addr = disp;
   if (base_reg != -1)  addr += reg_l(base_reg);
   if (index_reg != -1) addr += reg_l(index_reg) << scale;
@@ -119,8 +130,9 @@ static void decode_rm(Decode *s, int *rm_reg, word_t *rm_addr, int *reg, int wid
 
 #define Rr reg_read
 #define Rw reg_write
-#define Mr vaddr_read
-#define Mw vaddr_write
+#define SEG (s->isa.sreg == -1 ? R_DS : s->isa.sreg)
+#define Mr(addr, len) vaddr_read(seg_linear(SEG, addr, len), len)
+#define Mw(addr, len, data) vaddr_write(seg_linear(SEG, addr, len), len, data)
 #define RMr(reg, w)  (reg != -1 ? Rr(reg, w) : Mr(addr, w))
 #define RMw(data) do { if (rd != -1) Rw(rd, w, data); else Mw(addr, w, data); } while (0)
 
@@ -163,6 +175,7 @@ static void decode_operand(Decode *s, uint8_t opcode, int *rd_, word_t *src1,
     case TYPE_G2E:  decode_rm(s, rd_, addr, rs, w); src1r(*rs); break;
     case TYPE_E2G:  decode_rm(s, rs, addr, rd_, w); break;
     case TYPE_I2E:  decode_rm(s, rd_, addr, gp_idx, w); imm(); break;
+    case TYPE_E:    decode_rm(s, rd_, addr, gp_idx, w); break;
     case TYPE_O2a:  destr(R_EAX); *addr = x86_inst_fetch(s, 4); break;
     case TYPE_a2O:  *rs = R_EAX;  *addr = x86_inst_fetch(s, 4); break;
     case TYPE_N:    break;
@@ -176,9 +189,26 @@ static void decode_operand(Decode *s, uint8_t opcode, int *rd_, word_t *src1,
   }; \
 } while (0)
 
+static void lgdt(Decode *s, vaddr_t addr) {
+  cpu.gdtr.limit = Mr(addr, 2);
+  cpu.gdtr.base = Mr(addr + 2, 4);
+}
+
+#define gp7() do { \
+  switch (gp_idx) { \
+    case 2: lgdt(s, addr); break; \
+    case 7: tlb_flush(seg_linear(SEG, addr, 1)); break; \
+    default: INV(s->pc); \
+  }; \
+} while (0)
+
 void _2byte_esc(Decode *s, bool is_operand_size_16) {
   uint8_t opcode = x86_inst_fetch(s, 1);
   INSTPAT_START();
+  INSTPAT("0000 0001", gp7,    E,    0, gp7());
+  // the r/m field is always a register, and the reg field is the index of CR
+  INSTPAT("0010 0000", mov_cr, E2G,  4, Rw(rs, 4, cr_read(rd)));
+  INSTPAT("0010 0010", mov_cr, E2G,  4, cr_write(rd, Rr(rs, 4)));
   INSTPAT("???? ????", inv,    N,    0, INV(s->pc));
   INSTPAT_END();
 }
@@ -186,6 +216,7 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
 int isa_exec_once(Decode *s) {
   bool is_operand_size_16 = false;
   uint8_t opcode = 0;
+  s->isa.sreg = -1;
 
 again:
   opcode = x86_inst_fetch(s, 1);
@@ -195,12 +226,16 @@ again:
   INSTPAT("0000 1111", 2byte_esc, N,    0, _2byte_esc(s, is_operand_size_16));
 
   INSTPAT("0110 0110", data_size, N,    0, is_operand_size_16 = true; goto again;);
+  INSTPAT("001? ?110", seg,       N,    0, s->isa.sreg = BITS(opcode, 4, 3); goto again;);
+  INSTPAT("0110 010?", seg,       N,    0, s->isa.sreg = R_FS + BITS(opcode, 0, 0); goto again;);
 
   INSTPAT("1000 0000", gp1,       I2E,  1, gp1());
   INSTPAT("1000 1000", mov,       G2E,  1, RMw(src1));
   INSTPAT("1000 1001", mov,       G2E,  0, RMw(src1));
   INSTPAT("1000 1010", mov,       E2G,  1, Rw(rd, w, RMr(rs, w)));
   INSTPAT("1000 1011", mov,       E2G,  0, Rw(rd, w, RMr(rs, w)));
+  INSTPAT("1000 1100", mov_sreg,  E2G,  2, if (rs != -1) Rw(rs, 4, cpu.sreg[rd].sel); else Mw(addr, 2, cpu.sreg[rd].sel));
+  INSTPAT("1000 1110", mov_sreg,  E2G,  2, load_sreg(rd, RMr(rs, 2)));
 
   INSTPAT("1010 0000", mov,       O2a,  1, Rw(R_EAX, 1, Mr(addr, 1)));
   INSTPAT("1010 0001", mov,       O2a,  0, Rw(R_EAX, w, Mr(addr, w)));
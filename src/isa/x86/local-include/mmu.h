@@ -0,0 +1,40 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __X86_MMU_H__
+#define __X86_MMU_H__
+
+#include <isa.h>
+
+// control registers
+word_t cr_read(int idx);
+void cr_write(int idx, word_t data);
+
+// paging
+void tlb_flush(vaddr_t vaddr);
+void tlb_flush_all();
+
+// segmentation
+void init_seg();
+void load_sreg(int idx, uint16_t sel);
+vaddr_t seg_translate(int idx, vaddr_t offset, int len);
+
+static inline vaddr_t seg_linear(int idx, vaddr_t offset, int len) {
+  // skip the segmentation arithmetic when all segments are flat
+  if (likely(cpu.seg_flat)) return offset;
+  return seg_translate(idx, offset, len);
+}
+
+#endif
@@ -16,7 +16,134 @@
 #include <isa.h>
 #include <memory/paddr.h>
 #include <memory/vaddr.h>
+#include "../local-include/mmu.h"
+
+#define PTE_P  0x001
+#define PTE_W  0x002
+#define PTE_A  0x020
+#define PTE_D  0x040
+#define PTE_PS 0x080
+
+/* A direct-mapped cache of translations on the host side. It is
+ * flushed when CR0, CR3 or CR4 is written, and by `invlpg'. Like the
+ * TLB of a real i386, it does not track later changes of page tables.
+ */
+#define TLB_SIZE 1024
+
+typedef struct {
+  uint32_t vpn;
+  uint32_t ppn;
+  bool valid;
+  bool dirty; // the D bit is already set in the page table
+  bool large; // a 4KB piece of a 4MB page
+} TLBEntry;
+
+static TLBEntry tlb[TLB_SIZE] = {};
+
+void tlb_flush(vaddr_t vaddr) {
+  uint32_t vpn = vaddr >> PAGE_SHIFT;
+  TLBEntry *e = &tlb[vpn % TLB_SIZE];
+  if (e->vpn == vpn) e->valid = false;
+  // the other pieces of a 4MB page are mapped by the same PDE
+  uint32_t base = vpn & ~0x3ffu;
+  for (uint32_t v = base; v < base + 0x400; v ++) {
+    e = &tlb[v % TLB_SIZE];
+    if (e->vpn == v && e->large) e->valid = false;
+  }
+}
+
+void tlb_flush_all() {
+  for (int i = 0; i < TLB_SIZE; i ++) {
+    tlb[i].valid = false;
+  }
+}
+
+word_t cr_read(int idx) {
+  switch (idx) {
+    case 0: return cpu.cr0;
+    case 2: return cpu.cr2;
+    case 3: return cpu.cr3;
+    case 4: return cpu.cr4;
+    default: panic("invalid control register CR%d at pc = " FMT_WORD, idx, cpu.pc);
+  }
+}
+
+void cr_write(int idx, word_t data) {
+  switch (idx) {
+    case 0: cpu.cr0 = data; tlb_flush_all(); break;
+    case 2: cpu.cr2 = data; break;
+    case 3: cpu.cr3 = data; tlb_flush_all(); break;
+    case 4: cpu.cr4 = data; tlb_flush_all(); break;
+    default: panic("invalid control register CR%d at pc = " FMT_WORD, idx, cpu.pc);
+  }
+}
+
+// set the A bit, and the D bit for write, if they are not set yet
+static uint32_t update_pte(paddr_t pte_addr, uint32_t pte, int type) {
+  uint32_t new_pte = pte | PTE_A | (type == MEM_TYPE_WRITE ? PTE_D : 0);
+  if (new_pte != pte) paddr_write(pte_addr, 4, new_pte);
+  return new_pte;
+}
+
+static void page_fault(vaddr_t vaddr, const char *level, uint32_t entry) {
+  // #PF is not supported yet
+  cpu.cr2 = vaddr;
+  panic("page fault at pc = " FMT_WORD ", vaddr = " FMT_WORD ", cr3 = " FMT_WORD
+      ", %s = " FMT_WORD, cpu.pc, vaddr, cpu.cr3, level, entry);
+}
+
+static TLBEntry* page_walk(vaddr_t vaddr, int type) {
+  paddr_t pde_addr = (cpu.cr3 & ~PAGE_MASK) + sizeof(uint32_t) * BITS(vaddr, 31, 22);
+  uint32_t pde = paddr_read(pde_addr, 4);
+  if (!(pde & PTE_P)) page_fault(vaddr, "pde", pde);
+
+  uint32_t ppn, flags;
+  bool large = (pde & PTE_PS) && (cpu.cr4 & CR4_PSE);
+  if (large) {
+    // 4MB page
+    pde = update_pte(pde_addr, pde, type);
+    ppn = (pde >> PAGE_SHIFT & ~0x3ffu) | BITS(vaddr, 21, 12);
+    flags = pde;
+  } else {
+    pde = update_pte(pde_addr, pde, MEM_TYPE_READ);
+    paddr_t pte_addr = (pde & ~PAGE_MASK) + sizeof(uint32_t) * BITS(vaddr, 21, 12);
+    uint32_t pte = paddr_read(pte_addr, 4);
+    if (!(pte & PTE_P)) page_fault(vaddr, "pte", pte);
+    pte = update_pte(pte_addr, pte, type);
+    ppn = pte >> PAGE_SHIFT;
+    flags = pte;
+  }
+
+  uint32_t vpn = vaddr >> PAGE_SHIFT;
+  TLBEntry *e = &tlb[vpn % TLB_SIZE];
+  *e = (TLBEntry) { .vpn = vpn, .ppn = ppn, .valid = true, .dirty = (flags & PTE_D) != 0, .large = large };
+  return e;
+}
+
+/* Walk the page table for the debugger. Unlike page_walk(), it neither
+ * sets the A/D bits nor fills the TLB, and returns false instead of
+ * raising a page fault.
+ */
+bool isa_mmu_debug_translate(vaddr_t vaddr, paddr_t *paddr) {
+  word_t pde, pte;
+  paddr_t pde_addr = (cpu.cr3 & ~PAGE_MASK) + sizeof(uint32_t) * BITS(vaddr, 31, 22);
+  if (!paddr_peek(pde_addr, 4, &pde) || !(pde & PTE_P)) return false;
+  if ((pde & PTE_PS) && (cpu.cr4 & CR4_PSE)) {
+    *paddr = (pde & ~0x3fffffu) | BITS(vaddr, 21, 0);
+    return true;
+  }
+  paddr_t pte_addr = (pde & ~PAGE_MASK) + sizeof(uint32_t) * BITS(vaddr, 21, 12);
+  if (!paddr_peek(pte_addr, 4, &pte) || !(pte & PTE_P)) return false;
+  *paddr = (pte & ~PAGE_MASK) | (vaddr & PAGE_MASK);
+  return true;
+}
 
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
-  return MEM_RET_FAIL;
+  assert((vaddr & PAGE_MASK) + len <= PAGE_SIZE);
+  uint32_t vpn = vaddr >> PAGE_SHIFT;
+  TLBEntry *e = &tlb[vpn % TLB_SIZE];
+  bool hit = likely(e->valid && e->vpn == vpn && (type != MEM_TYPE_WRITE || e->dirty));
+  IFDEF(CONFIG_ISTAT, istat_count(istat_tlb[hit]));
+  if (!hit) e = page_walk(vaddr, type);
+  return ((paddr_t)e->ppn << PAGE_SHIFT) | (vaddr & PAGE_MASK);
 }
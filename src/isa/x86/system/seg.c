@@ -0,0 +1,75 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/vaddr.h>
+#include "../local-include/mmu.h"
+#include "../local-include/reg.h"
+
+#define SEG_LIMIT_MAX 0xffffffffu
+
+static void update_seg_flat() {
+  bool flat = true;
+  for (int i = R_ES; i <= R_GS; i ++) {
+    // a null data segment can not be used, so it does not matter
+    bool unused = (cpu.sreg[i].sel & ~0x3) == 0 && i != R_CS && i != R_SS;
+    if (!unused && (cpu.sreg[i].base != 0 || cpu.sreg[i].limit != SEG_LIMIT_MAX)) flat = false;
+  }
+  cpu.seg_flat = flat;
+}
+
+void init_seg() {
+  // NEMU starts in protected mode with flat segments
+  for (int i = R_ES; i <= R_GS; i ++) {
+    cpu.sreg[i].sel = 0;
+    cpu.sreg[i].base = 0;
+    cpu.sreg[i].limit = SEG_LIMIT_MAX;
+  }
+  cpu.seg_flat = true;
+}
+
+void load_sreg(int idx, uint16_t sel) {
+  IFDEF(CONFIG_RT_CHECK, assert(idx >= R_ES && idx <= R_GS));
+  Assert((sel & 0x4) == 0, "LDT is not supported, %s = %#x at pc = " FMT_WORD,
+      sreg_name(idx), sel, cpu.pc);
+  cpu.sreg[idx].sel = sel;
+  if ((sel & ~0x3) == 0) {
+    Assert(idx != R_CS && idx != R_SS, "load null selector to %s at pc = " FMT_WORD,
+        sreg_name(idx), cpu.pc);
+    cpu.sreg[idx].base = 0;
+    cpu.sreg[idx].limit = 0;
+  } else {
+    uint32_t offset = sel & ~0x7;
+    Assert(offset + 7 <= cpu.gdtr.limit, "selector %#x is out of GDT at pc = " FMT_WORD, sel, cpu.pc);
+    uint32_t lo = vaddr_read(cpu.gdtr.base + offset, 4);
+    uint32_t hi = vaddr_read(cpu.gdtr.base + offset + 4, 4);
+    Assert(hi & (1u << 15), "segment %#x is not present at pc = " FMT_WORD, sel, cpu.pc);
+    uint32_t limit = BITS(lo, 15, 0) | (BITS(hi, 19, 16) << 16);
+    if (hi & (1u << 23)) limit = (limit << 12) | 0xfff; // G bit
+    cpu.sreg[idx].base = BITS(lo, 31, 16) | (BITS(hi, 7, 0) << 16) | (BITS(hi, 31, 24) << 24);
+    cpu.sreg[idx].limit = limit;
+  }
+  update_seg_flat();
+}
+
+vaddr_t seg_translate(int idx, vaddr_t offset, int len) {
+  Assert((cpu.sreg[idx].sel & ~0x3) != 0 || idx == R_CS || idx == R_SS,
+      "access via null segment %s at pc = " FMT_WORD, sreg_name(idx), cpu.pc);
+  // #GP is not supported yet, only expand-up segments are supported
+  Assert((uint64_t)offset + len - 1 <= cpu.sreg[idx].limit,
+      "offset " FMT_WORD " is out of the limit of %s (%#x) at pc = " FMT_WORD,
+      offset, sreg_name(idx), cpu.sreg[idx].limit, cpu.pc);
+  return cpu.sreg[idx].base + offset;
+}
@@ -16,6 +16,8 @@
 #include <memory/host.h>
 #include <memory/paddr.h>
 #include <device/mmio.h>
+#include <cpu/difftest.h>
+#include <cpu/reverse.h>
 #include <isa.h>
 
 #if   defined(CONFIG_PMEM_MALLOC)
@@ -30,12 +32,16 @@ paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
 static word_t pmem_read(paddr_t addr, int len) {
   word_t ret = host_read(guest_to_host(addr), len);
   IFDEF(CONFIG_MTRACE, log_write("[mtrace] read %d byte(s) from %#x, value = %u\n", len, addr, ret));
+  btrace(mem, TRACE_READ, len, addr, ret, 0);
   return ret;
 }
 
 static void pmem_write(paddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_REVERSE, rev_pmem_write(addr, len));
+  IFDEF(CONFIG_DIFFTEST_REPRO, repro_pmem_write(addr, len));
   host_write(guest_to_host(addr), len, data);
   IFDEF(CONFIG_MTRACE, log_write("[mtrace] write %d byte(s) to %#x, value = %u\n", len, addr, data));
+  btrace(mem, TRACE_WRITE, len, addr, data, 0);
 }
 
 static void out_of_bound(paddr_t addr) {
@@ -52,9 +58,29 @@ void init_mem() {
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
 }
 
+/* The host memory behind ADDR for the debugger, NULL if there is none.
+ * It is contiguous up to *HIGH, the last address of pmem or of the device.
+ */
+uint8_t* paddr_to_host(paddr_t addr, paddr_t *high) {
+  if (in_pmem(addr)) {
+    *high = PMEM_RIGHT;
+    return guest_to_host(addr);
+  }
+  IFDEF(CONFIG_DEVICE, return mmio_to_host(addr, high));
+  return NULL;
+}
+
+// read the physical memory for the debugger, without tracing the access
+bool paddr_peek(paddr_t addr, int len, word_t *data) {
+  if (!in_pmem(addr) || !in_pmem(addr + len - 1)) return false;
+  *data = host_read(guest_to_host(addr), len);
+  return true;
+}
+
 word_t paddr_read(paddr_t addr, int len) {
   if (likely(in_pmem(addr))) return pmem_read(addr, len);
   IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
+  IFDEF(CONFIG_TARGET_SHARE, return difftest_replay_mmio_read(addr, len));
   out_of_bound(addr);
   return 0;
 }
@@ -62,5 +88,6 @@ word_t paddr_read(paddr_t addr, int len) {
 void paddr_write(paddr_t addr, int len, word_t data) {
   if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
+  IFDEF(CONFIG_TARGET_SHARE, difftest_replay_mmio_write(addr, len, data); return);
   out_of_bound(addr);
 }
@@ -15,6 +15,8 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <monitor/sdb.h>
 
 paddr_t vaddr_to_paddr(vaddr_t vaddr, int len, int type) {
   int mmu_check_ret = isa_mmu_check(vaddr, len, type);
@@ -28,17 +30,85 @@ paddr_t vaddr_to_paddr(vaddr_t vaddr, int len, int type) {
   }
 }
 
+// translate VADDR for the debugger, without side effects on the guest
+bool vaddr_debug_to_paddr(vaddr_t vaddr, paddr_t *paddr) {
+  switch (isa_mmu_check(vaddr, 1, MEM_TYPE_READ)) {
+    case MMU_DIRECT: *paddr = vaddr; return true;
+    case MMU_TRANSLATE: return isa_mmu_debug_translate(vaddr, paddr);
+    default: return false;
+  }
+}
+
+/* Copy [ADDR, ADDR + LEN) of the guest memory to BUF for the debugger.
+ * The address is translated once per page and the data is copied from the
+ * host memory, so neither the devices nor the watchpoints see the access.
+ * Return the number of bytes copied, which is less than LEN at the first
+ * address that is unmapped or without memory.
+ */
+word_t vaddr_copy_out(void *buf, vaddr_t addr, word_t len) {
+  word_t done = 0;
+  while (done < len) {
+    vaddr_t vaddr = addr + done;
+    paddr_t paddr, high;
+    if (!vaddr_debug_to_paddr(vaddr, &paddr)) break;
+    uint8_t *host = paddr_to_host(paddr, &high);
+    if (host == NULL) break;
+    word_t n = PAGE_SIZE - (vaddr & PAGE_MASK);
+    if (high - paddr < n - 1) n = high - paddr + 1;
+    if (len - done < n) n = len - done;
+    memcpy((uint8_t *)buf + done, host, n);
+    done += n;
+  }
+  return done;
+}
+
+// A misaligned access may cross the page boundary, and the two pages
+// may be mapped to different physical pages. Such an access is split
+// into bytes, which are translated one by one.
+static inline bool cross_page(vaddr_t addr, int len, int type) {
+  return unlikely((addr & PAGE_MASK) + len > PAGE_SIZE) &&
+    isa_mmu_check(addr, len, type) == MMU_TRANSLATE;
+}
+
+static word_t vaddr_read_cross_page(vaddr_t addr, int len, int type) {
+  word_t data = 0;
+  for (int i = 0; i < len; i ++) {
+    data |= paddr_read(vaddr_to_paddr(addr + i, 1, type), 1) << (i * 8);
+  }
+  return data;
+}
+
+static void vaddr_write_cross_page(vaddr_t addr, int len, word_t data) {
+  for (int i = 0; i < len; i ++) {
+    paddr_write(vaddr_to_paddr(addr + i, 1, MEM_TYPE_WRITE), 1, data >> (i * 8));
+  }
+}
+
 word_t vaddr_ifetch(vaddr_t addr, int len) {
+  if (cross_page(addr, len, MEM_TYPE_IFETCH)) return vaddr_read_cross_page(addr, len, MEM_TYPE_IFETCH);
   paddr_t paddr = vaddr_to_paddr(addr, len, MEM_TYPE_IFETCH);
   return paddr_read(paddr, len);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
+  IFDEF(CONFIG_ISTAT, istat_count(istat_load[len]));
+#if defined(CONFIG_MEMWATCH) && !defined(CONFIG_TARGET_AM)
+  if (unlikely(mwp_maybe(MWP_READ, addr))) mwp_access(MWP_READ, addr, len, 0);
+#endif
+  if (cross_page(addr, len, MEM_TYPE_READ)) return vaddr_read_cross_page(addr, len, MEM_TYPE_READ);
   paddr_t paddr = vaddr_to_paddr(addr, len, MEM_TYPE_READ);
   return paddr_read(paddr, len);
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_ISTAT, istat_count(istat_store[len]));
+#if defined(CONFIG_WATCHPOINT) && !defined(CONFIG_TARGET_AM)
+  if (unlikely(wp_nr_mem > 0)) wp_store(addr, len);
+#endif
+#if defined(CONFIG_MEMWATCH) && !defined(CONFIG_TARGET_AM)
+  if (unlikely(mwp_maybe(MWP_WRITE, addr))) mwp_access(MWP_WRITE, addr, len, data);
+#endif
+  if (cross_page(addr, len, MEM_TYPE_WRITE)) { vaddr_write_cross_page(addr, len, data); return; }
   paddr_t paddr = vaddr_to_paddr(addr, len, MEM_TYPE_WRITE);
   return paddr_write(paddr, len, data);
 }
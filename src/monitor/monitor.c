@@ -16,6 +16,8 @@
 #include <isa.h>
 #include <memory/paddr.h>
 #include <monitor/sdb.h>
+#include <cpu/difftest.h>
+#include <cpu/input.h>
 #include <elf.h>
 
 void init_rand();
@@ -38,15 +40,111 @@ static void welcome() {
 
 #ifndef CONFIG_TARGET_AM
 #include <getopt.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 void sdb_set_batch_mode();
+void sdb_set_script(const char *file);
+void sdb_set_mi_mode();
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
 static char *elf_files = NULL;
+static char *repro_file = NULL;
+static char *trace_list = NULL;
+static char *trace_file = NULL;
+static char *pc_trace_file = NULL;
+static char *fprof_file = NULL;
+static char *pc_sample = NULL;
+static char *gdb_addr = NULL;
+static char *record_file = NULL;
+static char *replay_file = NULL;
+static char *stats_file = NULL;
+static char *script_file = NULL;
+static bool mi_mode = false;
 static int difftest_port = 1234;
 
+#define IN_FILE(size, off, len) ((uint64_t)(off) <= (size) && (uint64_t)(len) <= (size) - (uint64_t)(off))
+
+/* Fill [host, host + len) with the file at OFF, or with zeros if FD < 0.
+ * The whole pages inside are mapped instead of copied when the file
+ * offset is page aligned with them, so they are copy-on-write pages of
+ * the file, or zero pages allocated on the first access.
+ */
+static void place(uint8_t *host, uint64_t len, const uint8_t *src, int fd, uint64_t off) {
+  uintptr_t pg = sysconf(_SC_PAGESIZE);
+  uint8_t *a = (uint8_t *)(((uintptr_t)host + pg - 1) & ~(pg - 1));
+  uint8_t *b = (uint8_t *)(((uintptr_t)host + len) & ~(pg - 1));
+  if (a < b && (fd < 0 || (off + (a - host)) % pg == 0)) {
+    void *p = mmap(a, b - a, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | (fd < 0 ? MAP_ANONYMOUS : 0),
+        fd, fd < 0 ? 0 : off + (a - host));
+    Assert(p == a, "can not map the image to " FMT_PADDR, host_to_guest(a));
+    if (fd < 0) { memset(host, 0, a - host); memset(b, 0, host + len - b); }
+    else { memcpy(host, src, a - host); memcpy(b, src + (b - host), host + len - b); }
+  } else {
+    if (fd < 0) memset(host, 0, len);
+    else memcpy(host, src, len);
+  }
+}
+
+/* Place the PT_LOAD segments of an ELF image of class BITS at their
+ * physical addresses, and return the entry. HI is set to the end of
+ * the highest segment.
+ */
+#define def_load_segments(bits) \
+static uint64_t concat(load_segments, bits)(const uint8_t *base, size_t size, int fd, paddr_t *hi) { \
+  const concat3(Elf, bits, _Ehdr) *ehdr = (const void *)base; \
+  typedef concat3(Elf, bits, _Phdr) Phdr; \
+  Assert(IN_FILE(size, ehdr->e_phoff, (uint64_t)ehdr->e_phnum * sizeof(Phdr)) && \
+      (ehdr->e_phnum == 0 || ehdr->e_phentsize == sizeof(Phdr)), "bad program headers in '%s'", img_file); \
+  const Phdr *phdr = (const Phdr *)(base + ehdr->e_phoff); \
+  for (int i = 0; i < ehdr->e_phnum; i ++) { \
+    const Phdr *p = &phdr[i]; \
+    if (p->p_type != PT_LOAD || p->p_memsz == 0) continue; \
+    Assert(p->p_filesz <= p->p_memsz && IN_FILE(size, p->p_offset, p->p_filesz), "bad segment #%d in '%s'", i, img_file); \
+    Assert(in_pmem(p->p_paddr) && in_pmem(p->p_paddr + p->p_memsz - 1) && p->p_paddr + p->p_memsz - 1 >= p->p_paddr, \
+        "segment #%d [%#" PRIx64 ", %#" PRIx64 ") is out of pmem", i, (uint64_t)p->p_paddr, (uint64_t)(p->p_paddr + p->p_memsz)); \
+    uint8_t *host = guest_to_host(p->p_paddr); \
+    place(host, p->p_filesz, base + p->p_offset, fd, p->p_offset); \
+    place(host + p->p_filesz, p->p_memsz - p->p_filesz, NULL, -1, 0); \
+    Log("Load segment [" FMT_PADDR ", " FMT_PADDR "), file size = %#" PRIx64, (paddr_t)p->p_paddr, \
+        (paddr_t)(p->p_paddr + p->p_memsz), (uint64_t)p->p_filesz); \
+    if (p->p_paddr + p->p_memsz > *hi) *hi = p->p_paddr + p->p_memsz; \
+  } \
+  return ehdr->e_entry; \
+}
+
+def_load_segments(32)
+def_load_segments(64)
+
+static long load_elf_img() {
+  int fd = open(img_file, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", img_file);
+  struct stat st;
+  Assert(fstat(fd, &st) == 0, "Can not stat '%s'", img_file);
+  const uint8_t *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  Assert(base != MAP_FAILED, "Can not map '%s'", img_file);
+
+  Log("The image is ELF file %s, size = %ld", img_file, (long)st.st_size);
+  paddr_t hi = RESET_VECTOR;
+  uint64_t entry;
+  if (base[EI_CLASS] == ELFCLASS32 && st.st_size >= sizeof(Elf32_Ehdr)) entry = load_segments32(base, st.st_size, fd, &hi);
+  else if (base[EI_CLASS] == ELFCLASS64 && st.st_size >= sizeof(Elf64_Ehdr)) entry = load_segments64(base, st.st_size, fd, &hi);
+  else panic("unsupported ELF class in '%s'", img_file);
+  munmap((void *)base, st.st_size);
+  close(fd);
+
+  cpu.pc = entry;
+  Log("Entry = " FMT_WORD, cpu.pc);
+  // the symbols come from the image itself if no --elf is given
+  if (elf_files == NULL) elf_files = img_file;
+  return hi - RESET_VECTOR;
+}
+
 static long load_img() {
   if (img_file == NULL || strlen(img_file) == 0) {
     Log("No image is given. Use the default build-in image.");
@@ -56,6 +154,12 @@ static long load_img() {
   FILE *fp = fopen(img_file, "rb");
   Assert(fp, "Can not open '%s'", img_file);
 
+  char magic[SELFMAG];
+  if (fread(magic, SELFMAG, 1, fp) == 1 && memcmp(magic, ELFMAG, SELFMAG) == 0) {
+    fclose(fp);
+    return load_elf_img();
+  }
+
   fseek(fp, 0, SEEK_END);
   long size = ftell(fp);
 
@@ -69,88 +173,128 @@ static long load_img() {
   return size;
 }
 
-static bool parse_elf(const char *elf_file) {
-  Log("Parse ELF file %s", elf_file);
-  FILE *fp = fopen(elf_file, "rb");
-  Assert(fp, "Can not open '%s'", elf_file);
-
-  size_t __attribute__((unused)) n_read;
-
-  // read ELF header
-  Elf32_Ehdr ehdr;
-  n_read = fread(&ehdr, sizeof(ehdr), 1, fp);
-  if (ehdr.e_ident[EI_MAG0] != ELFMAG0 ||
-    ehdr.e_ident[EI_MAG1] != ELFMAG1 ||
-    ehdr.e_ident[EI_MAG2] != ELFMAG2 ||
-    ehdr.e_ident[EI_MAG3] != ELFMAG3) {
-    Log("%s is not a valid ELF file.", elf_file);
-    fclose(fp);
-    return false;
-  }
+typedef struct {
+  const char *file;
+  void *map;
+  size_t size;
+  struct { const char *name; uint64_t start, end; } *sym;
+  int nr_sym;
+  const char *err;
+} ElfSymbols;
+
+
+/* Collect the function symbols of an ELF file of class BITS. All the
+ * SHT_SYMTAB sections are used, or the SHT_DYNSYM ones if there is no
+ * SHT_SYMTAB. The names point into the mapping of the file.
+ */
+#define def_load_symbols(bits) \
+static void concat(load_symbols, bits)(ElfSymbols *e) { \
+  const uint8_t *base = e->map; \
+  const concat3(Elf, bits, _Ehdr) *ehdr = e->map; \
+  typedef concat3(Elf, bits, _Shdr) Shdr; \
+  typedef concat3(Elf, bits, _Sym) Sym; \
+  if (!IN_FILE(e->size, ehdr->e_shoff, (uint64_t)ehdr->e_shnum * sizeof(Shdr)) || \
+      (ehdr->e_shnum > 0 && ehdr->e_shentsize != sizeof(Shdr))) { e->err = "bad section headers"; return; } \
+  const Shdr *shdr = (const Shdr *)(base + ehdr->e_shoff); \
+  uint32_t type = SHT_SYMTAB; \
+  uint64_t nr_max = 0; \
+  for (;;) { \
+    for (int i = 0; i < ehdr->e_shnum; i ++) { \
+      if (shdr[i].sh_type == type && IN_FILE(e->size, shdr[i].sh_offset, shdr[i].sh_size)) \
+        nr_max += shdr[i].sh_size / sizeof(Sym); \
+    } \
+    if (nr_max > 0 || type == SHT_DYNSYM) break; \
+    type = SHT_DYNSYM; \
+  } \
+  if (nr_max == 0) { e->err = "symbol table not found"; return; } \
+  e->sym = malloc(sizeof(*e->sym) * nr_max); \
+  for (int i = 0; i < ehdr->e_shnum; i ++) { \
+    if (shdr[i].sh_type != type || !IN_FILE(e->size, shdr[i].sh_offset, shdr[i].sh_size)) continue; \
+    if (shdr[i].sh_link >= ehdr->e_shnum) continue; \
+    const Shdr *str = &shdr[shdr[i].sh_link]; \
+    if (!IN_FILE(e->size, str->sh_offset, str->sh_size)) continue; \
+    const char *strtab = (const char *)(base + str->sh_offset); \
+    const Sym *sym = (const Sym *)(base + shdr[i].sh_offset); \
+    for (uint64_t j = 0; j < shdr[i].sh_size / sizeof(Sym); j ++) { \
+      if (concat3(ELF, bits, _ST_TYPE)(sym[j].st_info) != STT_FUNC) continue; \
+      if (sym[j].st_name >= str->sh_size || strnlen(strtab + sym[j].st_name, str->sh_size - sym[j].st_name) == \
+          str->sh_size - sym[j].st_name) continue; \
+      e->sym[e->nr_sym].name = strtab + sym[j].st_name; \
+      e->sym[e->nr_sym].start = sym[j].st_value; \
+      e->sym[e->nr_sym].end = sym[j].st_value + sym[j].st_size; \
+      e->nr_sym ++; \
+    } \
+  } \
+}
 
-  // scan section headers
-  Elf32_Off symtab_offset = 0;
-  Elf32_Word symtab_size = 0;
-  Elf32_Word strtab_index = 0;
-  for (int i = 0; i < ehdr.e_shnum; ++i) {
-    fseek(fp, ehdr.e_shoff + i * ehdr.e_shentsize, SEEK_SET);
-    Elf32_Shdr shdr;
-    n_read = fread(&shdr, sizeof(shdr), 1, fp);
-    if (shdr.sh_type == SHT_SYMTAB) {
-      symtab_offset = shdr.sh_offset;
-      symtab_size = shdr.sh_size;
-      strtab_index = shdr.sh_link;
-      break;
-    }
-  }
+def_load_symbols(32)
+def_load_symbols(64)
+
+static void *load_symbols(void *arg) {
+  ElfSymbols *e = arg;
+  const unsigned char *ident = e->map;
+  if (e->size < EI_NIDENT || memcmp(ident, ELFMAG, SELFMAG) != 0) e->err = "not a valid ELF file";
+  else if (ident[EI_CLASS] == ELFCLASS32 && e->size >= sizeof(Elf32_Ehdr)) load_symbols32(e);
+  else if (ident[EI_CLASS] == ELFCLASS64 && e->size >= sizeof(Elf64_Ehdr)) load_symbols64(e);
+  else e->err = "unsupported ELF class";
+  return NULL;
+}
 
-  if (symtab_offset != 0 && symtab_size != 0) {
-    fseek(fp, ehdr.e_shoff + strtab_index * ehdr.e_shentsize, SEEK_SET);
-    Elf32_Shdr shdr;
-    n_read = fread(&shdr, sizeof(shdr), 1, fp);
-    Elf32_Off strtab_offset = shdr.sh_offset;
-    // parse symbol table
-    for (Elf32_Word i = 0; i < symtab_size / sizeof(Elf32_Sym); ++i) {
-      fseek(fp, symtab_offset + i * sizeof(Elf32_Sym), SEEK_SET);
-      Elf32_Sym sym;
-      n_read = fread(&sym, sizeof(sym), 1, fp);
-      if (ELF32_ST_TYPE(sym.st_info) != STT_FUNC) continue;
-      // read symbol name from strtab
-      char *sym_name = (char *)malloc(SYMBOL_NAME_MAX_LEN);
-      sym_name[SYMBOL_NAME_MAX_LEN - 1] = 0;
-      fseek(fp, strtab_offset + sym.st_name, SEEK_SET);
-      int n = 0;
-      while (n < SYMBOL_NAME_MAX_LEN - 1) {
-        char ch;
-        n_read = fread(&ch, 1, 1, fp);
-        sym_name[n] = ch;
-        if (ch == '\0') break;
-        ++n;
-      }
-      register_function(ELF32_ST_TYPE(sym.st_info) == STT_FUNC, sym_name, sym.st_value, sym.st_value + sym.st_size);
-      free(sym_name);
-    }
-  } else {
-      Log("Symbol table not found.");
-      fclose(fp);
-      return false;
+static bool map_elf(ElfSymbols *e) {
+  int fd = open(e->file, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", e->file);
+  struct stat st;
+  bool ok = (fstat(fd, &st) == 0 && st.st_size > 0);
+  if (ok) {
+    e->size = st.st_size;
+    e->map = mmap(NULL, e->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ok = (e->map != MAP_FAILED);
   }
-
-  fclose(fp);
-  return true;
+  close(fd);
+  if (!ok) e->err = "can not map the file";
+  return ok;
 }
 
+/* The symbols of the ELF files are collected in parallel, and then
+ * registered in the order of the files, so the result does not depend
+ * on the scheduling. ftrace sorts them on the first lookup.
+ */
 static void parse_elfs() {
   if (elf_files == NULL || strlen(elf_files) == 0) {
     Log("No ELF file is given.");
     return;
   }
-  const char *delim = ",";
-  char *elf_file = strtok(elf_files, delim);
-  while (elf_file != NULL) {
-    parse_elf(elf_file);
-    elf_file = strtok(NULL, delim);
+  int nr_elf = 1;
+  for (char *p = elf_files; *p; p ++) nr_elf += (*p == ',');
+  ElfSymbols *elf = calloc(nr_elf, sizeof(*elf));
+  pthread_t *thread = calloc(nr_elf, sizeof(*thread));
+  bool *started = calloc(nr_elf, sizeof(*started));
+  nr_elf = 0;
+  // `elf_files' may be argv or the image file, which should not be changed by strtok()
+  char *files = strdup(elf_files);
+  assert(files);
+  for (char *f = strtok(files, ","); f != NULL; f = strtok(NULL, ",")) {
+    Log("Parse ELF file %s", f);
+    ElfSymbols *e = &elf[nr_elf ++];
+    e->file = f;
+    if (!map_elf(e)) continue;
+    started[nr_elf - 1] = (pthread_create(&thread[nr_elf - 1], NULL, load_symbols, e) == 0);
+    if (!started[nr_elf - 1]) load_symbols(e);
   }
+  for (int i = 0; i < nr_elf; i ++) {
+    ElfSymbols *e = &elf[i];
+    if (started[i]) pthread_join(thread[i], NULL);
+    if (e->err != NULL) Log("%s: %s.", e->file, e->err);
+    for (int j = 0; j < e->nr_sym; j ++) {
+      register_function(true, e->sym[j].name, e->sym[j].start, e->sym[j].end);
+    }
+    free(e->sym);
+    if (e->map != NULL && e->map != MAP_FAILED) munmap(e->map, e->size);
+  }
+  free(started);
+  free(thread);
+  free(elf);
+  free(files);
   print_function_info();
 }
 
@@ -163,6 +307,18 @@ static int parse_args(int argc, char *argv[]) {
     {"help"     , no_argument      , NULL, 'h'},
     {"img"      , required_argument, NULL,  1 },
     {"elf"      , required_argument, NULL,  2 },
+    {"repro"    , required_argument, NULL,  3 },
+    {"trace"    , required_argument, NULL,  4 },
+    {"trace-file", required_argument, NULL, 5 },
+    {"pc-trace" , required_argument, NULL,  6 },
+    {"fprof"    , required_argument, NULL,  7 },
+    {"pc-sample", required_argument, NULL,  8 },
+    {"gdb"      , required_argument, NULL,  9 },
+    {"record"   , required_argument, NULL, 10 },
+    {"replay"   , required_argument, NULL, 11 },
+    {"script"   , required_argument, NULL, 12 },
+    {"mi"       , no_argument      , NULL, 13 },
+    {"stats"    , required_argument, NULL, 14 },
     {0          , 0                , NULL,  0 },
   };
   int o;
@@ -174,6 +330,18 @@ static int parse_args(int argc, char *argv[]) {
       case 'd': diff_so_file = optarg; break;
       case 1: img_file = optarg; break;
       case 2: elf_files = optarg; break;
+      case 3: repro_file = optarg; break;
+      case 4: trace_list = optarg; break;
+      case 5: trace_file = optarg; break;
+      case 6: pc_trace_file = optarg; break;
+      case 7: fprof_file = optarg; break;
+      case 8: pc_sample = optarg; break;
+      case 9: gdb_addr = optarg; break;
+      case 10: record_file = optarg; break;
+      case 11: replay_file = optarg; break;
+      case 12: script_file = optarg; break;
+      case 13: mi_mode = true; break;
+      case 14: stats_file = optarg; break;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
         printf("\t-b,--batch              run with batch mode\n");
@@ -182,6 +350,18 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
         printf("\t--img=IMAGE_FILE        load image file\n");
         printf("\t--elf=ELF_FILE        load ELF file\n");
+        printf("\t--repro=REPRO_FILE    replay the repro generated when DiffTest fails\n");
+        printf("\t--trace=LIST          enable binary trace categories, e.g. inst,mem,dev,func,exc,csr\n");
+        printf("\t--trace-file=FILE     stream binary trace to FILE\n");
+        printf("\t--pc-trace=FILE       write compressed PC trace of the whole run to FILE\n");
+        printf("\t--fprof=FILE          profile functions, write folded stacks to FILE at exit\n");
+        printf("\t--pc-sample=N[us]      sample the pc every N instructions or N us, report at exit\n");
+        printf("\t--gdb=[HOST:]PORT|unix:PATH  wait for gdb to connect instead of the sdb prompt\n");
+        printf("\t--record=FILE          record the device inputs of the run to FILE\n");
+        printf("\t--replay=FILE          replay the device inputs recorded in FILE\n");
+        printf("\t--script=FILE          run the sdb commands in FILE (- for stdin) instead of the prompt\n");
+        printf("\t--mi                   print machine-readable records around the commands of --script, which it requires\n");
+        printf("\t--stats=FILE           write the instruction statistics in JSON to FILE at exit\n");
         printf("\n");
         exit(0);
     }
@@ -201,6 +381,23 @@ void init_monitor(int argc, char *argv[]) {
   /* Open the log file. */
   init_log(log_file);
 
+  /* Set up the binary trace. */
+#ifdef CONFIG_BTRACE
+  if (trace_list != NULL && !btrace_set_mask(trace_list)) exit(1);
+  if (trace_file != NULL) btrace_open(trace_file);
+#else
+  if (trace_list != NULL || trace_file != NULL) panic("--trace requires CONFIG_BTRACE");
+#endif
+
+  /* Record or replay the device inputs, including the random seed used below. */
+  if (record_file != NULL && replay_file != NULL) panic("--record and --replay can not be used together");
+#ifdef CONFIG_RECORD
+  if (record_file != NULL) record_open(record_file);
+  if (replay_file != NULL) replay_open(replay_file);
+#else
+  if (record_file != NULL || replay_file != NULL) panic("--record and --replay require CONFIG_RECORD");
+#endif
+
   /* Initialize memory. */
   init_mem();
 
@@ -219,8 +416,46 @@ void init_monitor(int argc, char *argv[]) {
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
 
+  /* Replay from the checkpoint before a DiffTest failure. */
+  if (repro_file != NULL) {
+    IFDEF(CONFIG_DIFFTEST_REPRO, repro_load(repro_file));
+    IFNDEF(CONFIG_DIFFTEST_REPRO, panic("--repro requires CONFIG_DIFFTEST_REPRO"));
+  }
+
+  /* Start the PC trace from the entry. */
+  if (pc_trace_file != NULL) {
+    IFDEF(CONFIG_PCTRACE, pctrace_open(pc_trace_file));
+    IFNDEF(CONFIG_PCTRACE, panic("--pc-trace requires CONFIG_PCTRACE"));
+  }
+
+  /* Profile the functions with ftrace. */
+  if (fprof_file != NULL) {
+    IFDEF(CONFIG_FPROF, fprof_open(fprof_file));
+    IFNDEF(CONFIG_FPROF, panic("--fprof requires CONFIG_FPROF"));
+  }
+
+  /* Start sampling the pc. */
+  if (pc_sample != NULL) {
+    IFDEF(CONFIG_PCPROF, pcprof_start(pc_sample));
+    IFNDEF(CONFIG_PCPROF, panic("--pc-sample requires CONFIG_PCPROF"));
+  }
+
+  /* Collect the instruction statistics, which are shown at exit. */
+  IFDEF(CONFIG_ISTAT, istat_init(stats_file));
+  IFNDEF(CONFIG_ISTAT, if (stats_file != NULL) panic("--stats requires CONFIG_ISTAT"));
+
   /* Initialize the simple debugger. */
   init_sdb();
+  if (script_file != NULL) sdb_set_script(script_file);
+  // the records would be mixed with the prompt and the output of the guest
+  if (mi_mode && script_file == NULL) panic("--mi requires --script");
+  if (mi_mode) sdb_set_mi_mode();
+
+  /* Serve gdb instead of the sdb prompt. */
+  if (gdb_addr != NULL) {
+    IFDEF(CONFIG_GDBSTUB, gdb_listen(gdb_addr));
+    IFNDEF(CONFIG_GDBSTUB, panic("--gdb requires CONFIG_GDBSTUB"));
+  }
 
   IFDEF(CONFIG_ITRACE, init_disasm());
 
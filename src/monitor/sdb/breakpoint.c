@@ -0,0 +1,115 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <monitor/sdb.h>
+
+#ifdef CONFIG_BREAKPOINT
+
+/* The pc of every breakpoint sets a bit in bp_bitmap, so the execution
+ * loop only tests one bit per instruction, and looks up the list when
+ * the bit is set.
+ */
+
+typedef struct breakpoint {
+  int NO;
+  vaddr_t pc;
+  char *cond;  // NULL if unconditional
+  ExprCode code;
+  uint64_t hit;
+  struct breakpoint *next;
+} BP;
+
+static BP *head = NULL;
+uint8_t bp_bitmap[BP_BITMAP_BITS / 8] = {};
+
+static void set_bit(vaddr_t pc) {
+  uint32_t idx = pc & (BP_BITMAP_BITS - 1);
+  bp_bitmap[idx / 8] |= 1 << (idx % 8);
+}
+
+static void print_bp(BP *bp) {
+  int f = search_function(bp->pc);
+  printf("No.%d " FMT_WORD " <%s>, hit %" PRIu64 " time(s)", bp->NO, bp->pc,
+      f >= 0 ? function_list[f].name : "", bp->hit);
+  if (bp->cond) printf(" if %s", bp->cond);
+  printf("\n");
+}
+
+// return the number of the new breakpoint, 0 on failure
+int add_bp(vaddr_t pc, char *cond) {
+  BP *bp = calloc(1, sizeof(BP));
+  assert(bp);
+  if (cond != NULL) {
+    if (!expr_compile(cond, &bp->code)) {
+      printf("invalid condition: %s\n", cond);
+      free(bp);
+      return 0;
+    }
+    bp->cond = strdup(cond);
+  }
+  bp->NO = new_point_NO();
+  bp->pc = pc;
+  BP **p = &head;
+  while (*p != NULL) p = &(*p)->next;
+  *p = bp;
+  set_bit(pc);
+  printf("breakpoint ");
+  print_bp(bp);
+  return bp->NO;
+}
+
+bool del_bp(int n) {
+  for (BP **p = &head; *p != NULL; p = &(*p)->next) {
+    BP *bp = *p;
+    if (bp->NO != n) continue;
+    *p = bp->next;
+    expr_free(&bp->code);
+    free(bp->cond);
+    free(bp);
+    memset(bp_bitmap, 0, sizeof(bp_bitmap));
+    for (bp = head; bp != NULL; bp = bp->next) set_bit(bp->pc);
+    return true;
+  }
+  return false;
+}
+
+void display_bp() {
+  printf("Breakpoints\n");
+  for (BP *bp = head; bp != NULL; bp = bp->next) print_bp(bp);
+}
+
+// return true if a breakpoint at PC is hit
+bool check_bp(vaddr_t pc) {
+  bool stop = false;
+  for (BP *bp = head; bp != NULL; bp = bp->next) {
+    if (bp->pc != pc) continue;
+    if (bp->cond != NULL) {
+      bool success = true;
+      word_t val = expr_run(&bp->code, &success, NULL, NULL);
+      if (success && val == 0) continue;
+    }
+    if (!point_quiet) {
+      bp->hit ++;
+      printf("hit breakpoint ");
+      print_bp(bp);
+    }
+    point_stop = (PointStop) { .type = STOP_BP, .addr = pc };
+    stop = true;
+  }
+  return stop;
+}
+
+#endif
@@ -13,309 +13,305 @@
 * See the Mulan PSL v2 for more details.
 ***************************************************************************************/
 
-#include <isa.h>
 
-/* We use the POSIX regex functions to process regular expressions.
- * Type 'man regex' for more information about POSIX regex functions.
- */
-#include <regex.h>
+#include <isa.h>
 #include <string.h>
 #include <debug.h>
 #include <memory/vaddr.h>
+#include <monitor/sdb.h>
 
-#define MAX_TOKEN_NUM 10000
+/* The expression is scanned once by a hand-written lexer, and parsed by
+ * precedence climbing into an AST. The nodes are kept in an array with
+ * the children before their parent, so the root is the last node. The
+ * AST can be evaluated many times, e.g. by watchpoints.
+ */
 
 enum {
-  TK_NOTYPE = 256, TK_NUMBER, TK_HEX_NUMBER, TK_REG, TK_EQ, TK_NOT_EQ, TK_AND, TK_POS, TK_NEG, TK_DEREF
-  /* TODO: Add more token types */
-
+  TK_END = 256, TK_NUMBER, TK_REG, TK_SYMBOL,
+  TK_EQ, TK_NOT_EQ, TK_LE, TK_GE, TK_SHL, TK_SHR, TK_AND, TK_OR,
 };
 
-static struct rule {
-  const char *regex;
-  int token_type;
-} rules[] = {
-
-  /* TODO: Add more rules.
-   * Pay attention to the precedence level of different rules.
-   */
-
-  {" +", TK_NOTYPE},    // spaces
-  {"\\+", '+'},         // plus
-  {"-", '-'},           // minus
-  {"\\*", '*'},         // multiply
-  {"/", '/'},           // divide
-  {"\\(", '('},         // left parenthesis
-  {"\\)", ')'},         // right parenthesis
-  {"0[xX][0-9a-fA-F]+", TK_HEX_NUMBER},  // hexadecimal number
-  {"[[:digit:]]+", TK_NUMBER},           // decimal number
-  {"\\$[a-z0-9]+", TK_REG},
-  {"==", TK_EQ},        // equal
-  {"!=", TK_NOT_EQ},    // not equal
-  {"&&", TK_AND},       // logical and
-  {"\\+", TK_POS},      // positive
-  {"-", TK_NEG},        // negative
-  {"\\*", TK_DEREF},    // dereference
+enum {
+  OP_IMM, OP_REG, OP_REG_NAME,
+  // unary
+  OP_DEREF, OP_NEG, OP_NOT, OP_BIT_NOT,
+  // binary
+  OP_MUL, OP_DIV, OP_MOD, OP_ADD, OP_SUB, OP_SHL, OP_SHR,
+  OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NOT_EQ,
+  OP_BIT_AND, OP_XOR, OP_BIT_OR, OP_AND, OP_OR,
+  // ternary
+  OP_COND,
 };
 
-#define NR_REGEX ARRLEN(rules)
-
-static regex_t re[NR_REGEX] = {};
+typedef struct {
+  const char *e;   // the whole expression, for error messages
+  const char *p;   // the next character to scan
+  int type;        // the current token
+  const char *start;
+  int len;
+  word_t val;
+  ExprCode *code;
+  bool ok;
+} Parser;
+
+static void error(Parser *ps, const char *msg) {
+  if (!ps->ok) return;
+  int pos = ps->start - ps->e;
+  printf("%s at position %d\n%s\n%*.s^\n", msg, pos, ps->e, pos, "");
+  ps->ok = false;
+}
 
-/* Rules are used for many times.
- * Therefore we compile them only once before any usage.
- */
-void init_regex() {
-  int i;
-  char error_msg[128];
-  int ret;
+static inline bool is_ident(char c, bool first) {
+  return c == '_' || c == '.' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (!first && c >= '0' && c <= '9');
+}
 
-  for (i = 0; i < NR_REGEX; i ++) {
-    ret = regcomp(&re[i], rules[i].regex, REG_EXTENDED);
-    if (ret != 0) {
-      regerror(ret, &re[i], error_msg, 128);
-      panic("regex compilation failed: %s\n%s", error_msg, rules[i].regex);
+static void next(Parser *ps) {
+  const char *p = ps->p;
+  while (*p == ' ' || *p == '\t') p ++;
+  ps->start = p;
+  if (*p == '\0') {
+    ps->type = TK_END;
+  } else if (*p >= '0' && *p <= '9') {
+    char *end;
+    bool hex = (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'));
+    ps->val = strtoull(p, &end, hex ? 16 : 10);
+    while (*end == 'u' || *end == 'U' || *end == 'l' || *end == 'L') end ++;
+    if (is_ident(*end, false)) { ps->p = end; error(ps, "bad number"); }
+    ps->type = TK_NUMBER;
+    p = end;
+  } else if (*p == '$') {
+    p ++;
+    while (is_ident(*p, false)) p ++;
+    ps->type = TK_REG;
+  } else if (is_ident(*p, true)) {
+    while (is_ident(*p, false)) p ++;
+    ps->type = TK_SYMBOL;
+  } else {
+    static const struct { char s[3]; int type; } op2[] = {
+      {"==", TK_EQ}, {"!=", TK_NOT_EQ}, {"<=", TK_LE}, {">=", TK_GE},
+      {"<<", TK_SHL}, {">>", TK_SHR}, {"&&", TK_AND}, {"||", TK_OR},
+    };
+    ps->type = 0;
+    for (int i = 0; i < ARRLEN(op2); i ++) {
+      if (p[0] == op2[i].s[0] && p[1] == op2[i].s[1]) { ps->type = op2[i].type; p += 2; break; }
+    }
+    if (ps->type == 0) {
+      if (strchr("+-*/%<>&^|!~?:()", *p) == NULL) error(ps, "unknown character");
+      ps->type = *p ++;
     }
   }
+  ps->len = p - ps->start;
+  ps->p = p;
 }
 
-typedef struct token {
-  int type;
-  char str[32];
-} Token;
-
-static Token tokens[MAX_TOKEN_NUM] __attribute__((used)) = {};
-static int nr_token __attribute__((used))  = 0;
-
-static bool make_token(char *e) {
-  int position = 0;
-  int i;
-  regmatch_t pmatch;
-
-  nr_token = 0;
-
-  if (e == NULL) {
-    printf("empty expression\n");
-    return false;
+static int node(Parser *ps, ExprOp op) {
+  ExprCode *code = ps->code;
+  if (code->nr_op == code->size) {
+    code->size = (code->size == 0 ? 16 : code->size * 2);
+    code->op = realloc(code->op, sizeof(ExprOp) * code->size);
+    assert(code->op);
   }
+  code->op[code->nr_op] = op;
+  return code->nr_op ++;
+}
 
-  while (e[position] != '\0') {
-    Assert(nr_token < MAX_TOKEN_NUM, "expression too long");
-    /* Try all rules one by one. */
-    for (i = 0; i < NR_REGEX; i ++) {
-      if (regexec(&re[i], e + position, 1, &pmatch, 0) == 0 && pmatch.rm_so == 0) {
-        char *substr_start = e + position;
-        int substr_len = pmatch.rm_eo;
-
-        // printf("match rules[%d] = \"%s\" at position %d with len %d: %.*s\n",
-        //     i, rules[i].regex, position, substr_len, substr_len, substr_start);
-
-        position += substr_len;
-
-        /* TODO: Now a new token is recognized with rules[i]. Add codes
-         * to record the token in the array `tokens'. For certain types
-         * of tokens, some extra actions should be performed.
-         */
+static int node1(Parser *ps, int op, int a) { return node(ps, (ExprOp) { .op = op, .child = { a } }); }
+static int node2(Parser *ps, int op, int a, int b) { return node(ps, (ExprOp) { .op = op, .child = { a, b } }); }
 
-        int type = rules[i].token_type;
-        if (type != TK_NOTYPE) {
-            tokens[nr_token].type = rules[i].token_type;
-            strncpy(tokens[nr_token].str, substr_start, substr_len);
-            tokens[nr_token].str[substr_len] = '\0';
-            nr_token++;
-        }
+static int parse(Parser *ps, int min_prec);
 
-        break;
+static int parse_operand(Parser *ps) {
+  if (!ps->ok) return -1;
+  char name[SYMBOL_NAME_MAX_LEN];
+  int type = ps->type;
+  switch (type) {
+    case TK_NUMBER: {
+      word_t val = ps->val;
+      next(ps);
+      return node(ps, (ExprOp) { .op = OP_IMM, .imm = val });
+    }
+    case TK_REG: case TK_SYMBOL: {
+      int skip = (type == TK_REG);
+      snprintf(name, sizeof(name), "%.*s", ps->len - skip, ps->start + skip);
+      if (type == TK_SYMBOL) {
+        word_t addr;
+        if (!function_addr(name, &addr)) { error(ps, "unknown symbol"); return -1; }
+        next(ps);
+        return node(ps, (ExprOp) { .op = OP_IMM, .imm = addr });
       }
+      bool ok = false;
+      isa_reg_str2val(name, &ok);
+      if (!ok) { error(ps, "unknown register"); return -1; }
+      next(ps);
+      word_t *reg = isa_reg_str2ptr(name);
+      if (reg != NULL) return node(ps, (ExprOp) { .op = OP_REG, .reg = reg });
+      return node(ps, (ExprOp) { .op = OP_REG_NAME, .name = strdup(name) });
     }
-
-    if (i == NR_REGEX) {
-      printf("no match at position %d\n%s\n%*.s^\n", position, e, position, "");
-      return false;
+    case '(': {
+      next(ps);
+      int n = parse(ps, 0);
+      if (ps->type != ')') { error(ps, "expect )"); return -1; }
+      next(ps);
+      return n;
     }
-  }
-
-  return true;
-}
-
-bool possible_binary_op_prior_type(int type) {
-  return type == ')' || type == TK_NUMBER || type == TK_HEX_NUMBER || type == TK_REG;
-}
-
-bool is_operand(int type) {
-  return type == TK_NUMBER || type == TK_HEX_NUMBER || type == TK_REG;
-}
-
-// also check parentheses
-int eval_count_operand(int left, int right, bool *success) {
-  int n_operand = 0;
-  int level = 0;
-  for (int ind = left; ind <= right; ind++) {
-    if (is_operand(tokens[ind].type) && level == 0) {
-      n_operand++;
-    } else if (tokens[ind].type == '(') {
-      level++;
-    } else if (tokens[ind].type == ')') {
-      if (level == 0) {
-        printf("unmatched )\n");
-        *success = false;
-        return 0;
-      }
-      level--;
-      if (level == 0) {
-        n_operand++;
-      }
+    case '+': case '-': case '!': case '~': case '*': {
+      next(ps);
+      int n = parse_operand(ps);
+      if (type == '+') return n;
+      int op = (type == '-' ? OP_NEG : type == '!' ? OP_NOT : type == '~' ? OP_BIT_NOT : OP_DEREF);
+      return node1(ps, op, n);
     }
+    case ')': error(ps, "unmatched )"); return -1;
+    case TK_END: error(ps, "expect an operand"); return -1;
+    default: error(ps, "expect an operand"); return -1;
   }
-  if (level > 0) {
-    printf("unclosed (\n");
-    *success = false;
-    return 0;
-  }
-  return n_operand;
-}
-
-bool is_binary_operator(int token_type) {
-  return token_type == '+' || token_type == '-' || token_type == '*' || token_type == '/'
-    || token_type == TK_EQ || token_type == TK_NOT_EQ || token_type == TK_AND;
-}
-
-bool is_unary_operator(int token_type) {
-  return token_type == TK_POS || token_type == TK_NEG || token_type == TK_DEREF;
 }
 
-int binary_operator_precedence(int op) {
-  switch (op) {
-    case '*': case '/': return 1;
-    case '+': case '-': return 2;
-    case TK_EQ: case TK_NOT_EQ: return 3;
-    case TK_AND: return 4;
+// the precedence of binary operators, higher binds tighter
+static int binary_op(int type, int *op) {
+  switch (type) {
+    case '*': *op = OP_MUL; return 11;
+    case '/': *op = OP_DIV; return 11;
+    case '%': *op = OP_MOD; return 11;
+    case '+': *op = OP_ADD; return 10;
+    case '-': *op = OP_SUB; return 10;
+    case TK_SHL: *op = OP_SHL; return 9;
+    case TK_SHR: *op = OP_SHR; return 9;
+    case '<': *op = OP_LT; return 8;
+    case TK_LE: *op = OP_LE; return 8;
+    case '>': *op = OP_GT; return 8;
+    case TK_GE: *op = OP_GE; return 8;
+    case TK_EQ: *op = OP_EQ; return 7;
+    case TK_NOT_EQ: *op = OP_NOT_EQ; return 7;
+    case '&': *op = OP_BIT_AND; return 6;
+    case '^': *op = OP_XOR; return 5;
+    case '|': *op = OP_BIT_OR; return 4;
+    case TK_AND: *op = OP_AND; return 3;
+    case TK_OR: *op = OP_OR; return 2;
+    case '?': *op = OP_COND; return 1;
     default: return 0;
   }
 }
 
-// return true if current_op should be evaluated later
-bool binary_operator_cmp(int current_op, int previous_op) {
-  if (previous_op == -1) return true;
-  int p_current = binary_operator_precedence(current_op);
-  int p_previous = binary_operator_precedence(previous_op);
-  return p_current >= p_previous;
-}
-
-int find_main_operator(int left, int right, bool *success) {
-  int level = 0;
-  int ind = left;
-  int main_op_ind = -1;
-  int main_op_type = -1;
-  while (ind <= right) {
-    int token_type = tokens[ind].type;
-    if (token_type == '(') {
-      level++;
-    } else if (token_type == ')') {
-      level--;
-    } else if (level == 0 && is_binary_operator(token_type)) {
-      if (binary_operator_cmp(token_type, main_op_type)) {
-        main_op_ind = ind;
-        main_op_type = token_type;
-      }
+static int parse(Parser *ps, int min_prec) {
+  int lhs = parse_operand(ps);
+  int op, prec;
+  while (ps->ok && (prec = binary_op(ps->type, &op)) > 0 && prec >= min_prec) {
+    next(ps);
+    if (op == OP_COND) {
+      // right associative: a ? b : c ? d : e
+      int mid = parse(ps, 0);
+      if (ps->ok && ps->type != ':') { error(ps, "expect :"); return -1; }
+      next(ps);
+      int rhs = parse(ps, prec);
+      lhs = node(ps, (ExprOp) { .op = OP_COND, .child = { lhs, mid, rhs } });
+    } else {
+      int rhs = parse(ps, prec + 1);
+      lhs = node2(ps, op, lhs, rhs);
     }
-    ind++;
   }
-  return main_op_ind;
+  return lhs;
 }
 
-void print_tokens(int left, int right) {
-  printf("eval: ");
-  for (int i = left; i <= right; i++) {
-    printf("%s ", tokens[i].str);
+void expr_free(ExprCode *code) {
+  for (int i = 0; i < code->nr_op; i ++) free((void *)code->op[i].name);
+  free(code->op);
+  *code = (ExprCode) {};
+}
+
+/* Compile the expression into an AST, which can be run many times
+ * without parsing it again.
+ */
+bool expr_compile(char *e, ExprCode *code) {
+  *code = (ExprCode) {};
+  if (e == NULL) {
+    printf("empty expression\n");
+    return false;
   }
-  printf("\n");
+  Parser ps = { .e = e, .p = e, .code = code, .ok = true };
+  next(&ps);
+  parse(&ps, 0);
+  if (ps.ok && ps.type != TK_END) error(&ps, ps.type == ')' ? "unmatched )" : "expect an operator");
+  if (!ps.ok) expr_free(code);
+  return ps.ok;
 }
 
-uint32_t eval(int left, int right, bool *success) {
-  // print_tokens(left, right);
-  if (left > right) {
-    printf("invalid expression\n");
-    *success = false;
-    return 0;
+typedef struct {
+  const ExprCode *code;
+  void (*on_read)(void *arg, vaddr_t addr, int len);
+  void *arg;
+  bool ok;
+} Runner;
+
+static word_t run(Runner *r, int n) {
+  const ExprOp *o = &r->code->op[n];
+  switch (o->op) {
+    case OP_IMM: return o->imm;
+    case OP_REG: return *o->reg;
+    case OP_REG_NAME: return isa_reg_str2val(o->name, &r->ok);
+    case OP_AND: return run(r, o->child[0]) && run(r, o->child[1]);
+    case OP_OR: return run(r, o->child[0]) || run(r, o->child[1]);
+    case OP_COND: return run(r, o->child[0]) ? run(r, o->child[1]) : run(r, o->child[2]);
   }
-  int n_operand = eval_count_operand(left, right, success);
-  if (!*success) return 0;
-  // printf("n_operand: %d\n", n_operand);
-  if (n_operand == 0) {
-    printf("invalid expression, no operand\n");
-    *success = false;
-    return 0;
+  word_t a = run(r, o->child[0]);
+  switch (o->op) {
+    case OP_DEREF: {
+      if (r->on_read) r->on_read(r->arg, a, 4);
+      word_t data = 0;
+      if (vaddr_copy_out(&data, a, 4) != 4) {
+        if (r->ok) printf("can not access memory at " FMT_WORD "\n", a);
+        r->ok = false;
+      }
+      return data;
+    }
+    case OP_NEG: return -a;
+    case OP_NOT: return !a;
+    case OP_BIT_NOT: return ~a;
   }
-  if (n_operand == 1) {
-    if (tokens[left].type == '(' && tokens[right].type == ')') {
-      return eval(left + 1, right - 1, success);
-    } else {
-      if (is_operand(tokens[left].type)) {
-        Assert(left == right, "single operand parse error, left %d right %d", left, right);
-        if (tokens[left].type == TK_REG) {
-          return isa_reg_str2val(tokens[left].str + 1, success);
-        } else if (tokens[left].type == TK_NUMBER) {
-          return atoi(tokens[left].str);
-        } else if (tokens[left].type == TK_HEX_NUMBER) {
-          int t = 0;
-          sscanf(tokens[left].str, "%x", &t);
-          return t;
-        } else {
-          printf("invalid operand: %s\n", tokens[left].str);
-          return 0;
-        }
-      } else if (tokens[left].type == TK_POS) {
-        return eval(left + 1, right, success);
-      } else if (tokens[left].type == TK_NEG) {
-        return -eval(left + 1, right, success);
-      } else if (tokens[left].type == TK_DEREF) {
-        uint32_t addr = eval(left + 1, right, success);
-        return vaddr_read(addr, 4);
-      } else {
-        printf("invalid unary operator: %s\n", tokens[left].str);
+  word_t b = run(r, o->child[1]);
+  switch (o->op) {
+    case OP_MUL: return a * b;
+    case OP_DIV: case OP_MOD:
+      if (b == 0) {
+        if (r->ok) printf("divided by zero\n");
+        r->ok = false;
         return 0;
       }
-    }
-  } else {
-    int op_ind = find_main_operator(left, right, success);
-    if (!*success) return 0;
-    // printf("main binary operator at position %d: %s\n", op_ind, tokens[op_ind].str);
-    uint32_t val1 = eval(left, op_ind - 1, success);
-    uint32_t val2 = eval(op_ind + 1, right, success);
-    switch (tokens[op_ind].type) {
-      case '+': return val1 + val2;
-      case '-': return val1 - val2;
-      case '*': return val1 * val2;
-      case '/': return val1 / val2;
-      case TK_EQ: return val1 == val2;
-      case TK_NOT_EQ: return val1 != val2;
-      case TK_AND: return val1 && val2;
-      default: Assert(0, "unknown operator %s", tokens[op_ind].str);
-    }
+      return o->op == OP_DIV ? a / b : a % b;
+    case OP_ADD: return a + b;
+    case OP_SUB: return a - b;
+    case OP_SHL: return b >= sizeof(word_t) * 8 ? 0 : a << b;
+    case OP_SHR: return b >= sizeof(word_t) * 8 ? 0 : a >> b;
+    case OP_LT: return a < b;
+    case OP_LE: return a <= b;
+    case OP_GT: return a > b;
+    case OP_GE: return a >= b;
+    case OP_EQ: return a == b;
+    case OP_NOT_EQ: return a != b;
+    case OP_BIT_AND: return a & b;
+    case OP_XOR: return a ^ b;
+    case OP_BIT_OR: return a | b;
+    default: panic("unknown operator %d", o->op);
   }
 }
 
+/* Run the compiled expression. ON_READ, if not NULL, is called with
+ * every memory address read.
+ */
+word_t expr_run(const ExprCode *code, bool *success, void (*on_read)(void *arg, vaddr_t addr, int len), void *arg) {
+  Runner r = { .code = code, .on_read = on_read, .arg = arg, .ok = true };
+  word_t result = run(&r, code->nr_op - 1);
+  *success = r.ok;
+  return result;
+}
+
 word_t expr(char *e, bool *success) {
-  if (!make_token(e)) {
+  ExprCode code;
+  if (!expr_compile(e, &code)) {
     *success = false;
     return 0;
   }
-
-  /* TODO: Insert codes to evaluate the expression. */
-  
-  for (int i = 0; i < nr_token; i++) {
-    if (i == 0 || !possible_binary_op_prior_type(tokens[i - 1].type)) {
-      if (tokens[i].type == '*') {
-        tokens[i].type = TK_DEREF;
-      } else if (tokens[i].type == '+') {
-        tokens[i].type = TK_POS;
-      } else if (tokens[i].type == '-') {
-        tokens[i].type = TK_NEG;
-      }
-    }
-  }
-
-  word_t result = eval(0, nr_token - 1, success);
+  word_t result = expr_run(&code, success, NULL, NULL);
+  expr_free(&code);
   return result;
 }
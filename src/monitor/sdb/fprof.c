@@ -0,0 +1,200 @@
+/***************************************************************************************
+* Copyright (c) 2014-2022 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <common.h>
+#include <monitor/sdb.h>
+
+#ifdef CONFIG_FPROF
+
+/* Exact function profiler. The calls and returns seen by ftrace walk an
+ * aggregated call tree, and the guest instructions executed between two
+ * of them are charged to the current node. The jal/jalr of a call is
+ * charged to the caller, and the ret is charged to the callee.
+ */
+
+extern uint64_t g_nr_guest_inst;
+typedef struct {
+  int func;        // index in function_list, -1 if unknown
+  word_t addr;     // entry of the function
+  int parent, child, sibling;
+  uint64_t calls;
+  uint64_t self;   // exclusive instruction count
+  uint64_t total;  // inclusive instruction count, computed at report time
+} FProfNode;
+
+bool fprof_enabled = false;
+static const char *fprof_file = NULL;
+static FProfNode *node = NULL;
+static int nr_node = 0, node_size = 0;
+static int cur = 0;
+static uint64_t mark = 0;
+
+static int new_node(int parent, int func, word_t addr) {
+  if (nr_node == node_size) {
+    node_size = (node_size == 0 ? 1024 : node_size * 2);
+    node = realloc(node, sizeof(*node) * node_size);
+    Assert(node != NULL, "no memory for function profiler");
+  }
+  node[nr_node] = (FProfNode) { .func = func, .addr = addr, .parent = parent, .child = -1, .sibling = -1 };
+  if (parent >= 0) {
+    node[nr_node].sibling = node[parent].child;
+    node[parent].child = nr_node;
+  }
+  return nr_node ++;
+}
+
+static inline void charge(uint64_t now) {
+  node[cur].self += now - mark;
+  mark = now;
+}
+
+void fprof_call(int caller, word_t target, int callee) {
+  if (nr_node == 0) {
+    // the root is the function making the first call
+    cur = new_node(-1, caller, 0);
+    node[cur].calls = 1;
+    mark = 0;
+  }
+  charge(g_nr_guest_inst + 1);
+  int c;
+  for (c = node[cur].child; c >= 0; c = node[c].sibling) {
+    if (callee >= 0 ? node[c].func == callee : (node[c].func < 0 && node[c].addr == target)) break;
+  }
+  if (c < 0) c = new_node(cur, callee, target);
+  node[c].calls ++;
+  cur = c;
+}
+
+void fprof_ret() {
+  if (nr_node == 0) return;
+  charge(g_nr_guest_inst + 1);
+  if (node[cur].parent >= 0) cur = node[cur].parent;
+}
+
+static void node_name(int i, char *buf, size_t size) {
+  if (node[i].func >= 0) snprintf(buf, size, "%s", function_list[node[i].func].name);
+  else if (node[i].parent < 0) snprintf(buf, size, "(root)");
+  else snprintf(buf, size, FMT_WORD, node[i].addr);
+}
+
+// children are always created after their parent
+static void compute_total() {
+  for (int i = 0; i < nr_node; i ++) node[i].total = node[i].self;
+  for (int i = nr_node - 1; i > 0; i --) node[node[i].parent].total += node[i].total;
+}
+
+static void write_folded(FILE *fp, int i, char *path, int len, int size) {
+  char name[SYMBOL_NAME_MAX_LEN];
+  node_name(i, name, sizeof(name));
+  int n = snprintf(path + len, size - len, "%s%s", len == 0 ? "" : ";", name);
+  if (n >= size - len) n = size - len - 1;
+  if (node[i].self > 0) fprintf(fp, "%s %" PRIu64 "\n", path, node[i].self);
+  for (int c = node[i].child; c >= 0; c = node[c].sibling) write_folded(fp, c, path, len + n, size);
+  path[len] = '\0';
+}
+
+typedef struct {
+  int node;  // any node of the function, for the name
+  uint64_t calls, self, total;
+} FProfFunc;
+
+static int func_cmp(const void *a, const void *b) {
+  const FProfFunc *x = a, *y = b;
+  if (x->self != y->self) return x->self < y->self ? 1 : -1;
+  return x->total < y->total ? 1 : (x->total > y->total ? -1 : 0);
+}
+
+// The inclusive count of a function is only taken from its outermost
+// frames, so recursion is not counted twice.
+static void aggregate(int i, FProfFunc *f, int *f_idx, int *depth) {
+  int k = f_idx[i];
+  f[k].node = i;
+  f[k].calls += node[i].calls;
+  f[k].self += node[i].self;
+  if (depth[k] ++ == 0) f[k].total += node[i].total;
+  for (int c = node[i].child; c >= 0; c = node[c].sibling) aggregate(c, f, f_idx, depth);
+  depth[k] --;
+}
+
+void fprof_display(int n) {
+  if (nr_node == 0) {
+    printf("no function call is profiled\n");
+    return;
+  }
+  charge(g_nr_guest_inst);
+  compute_total();
+
+  // map every node to a function, the unknown ones are told apart by address
+  int max_func = -1;
+  for (int i = 0; i < nr_node; i ++) if (node[i].func > max_func) max_func = node[i].func;
+  int *func_map = malloc(sizeof(int) * (max_func + 1));
+  for (int i = 0; i <= max_func; i ++) func_map[i] = -1;
+  int *f_idx = malloc(sizeof(int) * nr_node);
+  int nr_func = 0;
+  for (int i = 0; i < nr_node; i ++) {
+    if (node[i].func >= 0) {
+      if (func_map[node[i].func] < 0) func_map[node[i].func] = nr_func ++;
+      f_idx[i] = func_map[node[i].func];
+      continue;
+    }
+    f_idx[i] = -1;
+    for (int j = 0; j < i; j ++) {
+      if (node[j].func < 0 && node[j].addr == node[i].addr) { f_idx[i] = f_idx[j]; break; }
+    }
+    if (f_idx[i] < 0) f_idx[i] = nr_func ++;
+  }
+  free(func_map);
+  FProfFunc *f = calloc(nr_func, sizeof(*f));
+  int *depth = calloc(nr_func, sizeof(int));
+  aggregate(0, f, f_idx, depth);
+  qsort(f, nr_func, sizeof(*f), func_cmp);
+
+  double all = node[0].total;
+  printf("%12s %14s %7s %14s %7s  %s\n", "calls", "self", "self%", "total", "total%", "function");
+  for (int i = 0; i < nr_func && i < n; i ++) {
+    char name[SYMBOL_NAME_MAX_LEN];
+    node_name(f[i].node, name, sizeof(name));
+    printf("%12" PRIu64 " %14" PRIu64 " %6.2f%% %14" PRIu64 " %6.2f%%  %s\n", f[i].calls,
+        f[i].self, f[i].self * 100 / all, f[i].total, f[i].total * 100 / all, name);
+  }
+  free(depth);
+  free(f);
+  free(f_idx);
+}
+
+static void fprof_close() {
+  if (nr_node == 0) return;
+  charge(g_nr_guest_inst);
+  FILE *fp = fopen(fprof_file, "w");
+  if (fp == NULL) {
+    Log("can not open '%s' to write the function profile", fprof_file);
+  } else {
+    static char path[4096];
+    path[0] = '\0';
+    write_folded(fp, 0, path, 0, sizeof(path));
+    fclose(fp);
+    Log("folded stacks of the function profile are written to %s", fprof_file);
+  }
+  fprof_display(CONFIG_FPROF_TOP);
+}
+
+void fprof_open(const char *file) {
+  fprof_file = file;
+  fprof_enabled = true;
+  atexit(fprof_close);
+}
+
+#endif
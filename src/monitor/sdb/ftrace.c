@@ -16,13 +16,18 @@
 #include <common.h>
 #include <monitor/sdb.h>
 
-#define FUNCTION_LIST_SIZE 3000
 #define FUNCTION_STACK_SIZE 100
 #define FUNCTION_TRACE_SIZE 100
 #define FUNCTION_CALL_STRING "Call %#8x <%s> from <%s>\n"
 #define FUNCTION_RET_STRING "Ret  <%s> to <%s @%#8x>\n"
-struct function_info function_list[FUNCTION_LIST_SIZE];
+struct function_info *function_list = NULL;
 static int n_function = 0;
+static int function_list_size = 0;
+// max end address of function_list[0..i], valid after sorting
+static word_t *function_reach = NULL;
+static bool function_list_sorted = true;
+// the last two functions found, jal/jalr usually come from the same caller
+static int function_hit[2] = { -1, -1 };
 struct function_trace_item function_trace[FUNCTION_TRACE_SIZE];
 int n_function_trace = 0;
 int function_trace_current_index = 0;
@@ -30,29 +35,89 @@ struct function_trace_item function_stack[FUNCTION_STACK_SIZE];
 int n_function_stack = 0;
 
 void register_function(bool is_function, const char *name, word_t start_address, word_t end_address) {
-  Assert(n_function < FUNCTION_LIST_SIZE, "function info list full");
+  if (n_function == function_list_size) {
+    function_list_size = (function_list_size == 0 ? 1024 : function_list_size * 2);
+    function_list = realloc(function_list, sizeof(*function_list) * function_list_size);
+    function_reach = realloc(function_reach, sizeof(*function_reach) * function_list_size);
+    Assert(function_list != NULL && function_reach != NULL, "no memory for function info list");
+  }
   function_list[n_function].is_function = is_function;
   function_list[n_function].start_address = start_address;
   function_list[n_function].end_address = end_address;
-  strcpy(function_list[n_function].name, name);
+  snprintf(function_list[n_function].name, SYMBOL_NAME_MAX_LEN, "%s", name);
+  function_list[n_function].id = n_function;
   ++n_function;
+  function_list_sorted = false;
 }
 
-void print_function_info() {
+static inline word_t function_end(const struct function_info *fip) {
+  return fip->is_function ? fip->end_address : fip->start_address + 1;
+}
+
+static inline bool function_contains(int i, word_t address) {
+  const struct function_info *fip = &function_list[i];
+  return address >= fip->start_address && address < function_end(fip);
+}
+
+static int function_cmp(const void *a, const void *b) {
+  const struct function_info *x = a, *y = b;
+  if (x->start_address != y->start_address) return x->start_address < y->start_address ? -1 : 1;
+  return x->id - y->id;
+}
+
+// Sort the functions by start address, so that the lookup is a binary search.
+// Aliases of the same address keep their registration order.
+static void sort_function_list() {
+  qsort(function_list, n_function, sizeof(*function_list), function_cmp);
   for (int i = 0; i < n_function; ++i) {
-    struct function_info *fip = function_list + i;
-    log_write("0x%8x - 0x%8x  %s\n", fip->start_address, fip->end_address, fip->name);
+    word_t end = function_end(&function_list[i]);
+    function_reach[i] = (i > 0 && function_reach[i - 1] > end) ? function_reach[i - 1] : end;
   }
+  function_hit[0] = function_hit[1] = -1;
+  function_list_sorted = true;
 }
 
-int search_function(word_t address) {
+bool function_addr(const char *name, word_t *addr) {
   for (int i = 0; i < n_function; ++i) {
-    struct function_info *fip = function_list + i;
-    if ((fip->is_function && address >= fip->start_address && address < fip->end_address)
-      || (!fip->is_function && address == fip->start_address)) {
-      return i;
+    if (strcmp(function_list[i].name, name) == 0) {
+      *addr = function_list[i].start_address;
+      return true;
     }
   }
+  return false;
+}
+
+void print_function_info() {
+  if (!function_list_sorted) sort_function_list();
+  for (int i = 0; i < n_function; ++i) {
+    log_write("0x%8x - 0x%8x  %s\n", function_list[i].start_address, function_list[i].end_address, function_list[i].name);
+  }
+}
+
+int search_function(word_t address) {
+  if (!function_list_sorted) sort_function_list();
+  if (function_hit[0] >= 0 && function_contains(function_hit[0], address)) return function_hit[0];
+  if (function_hit[1] >= 0 && function_contains(function_hit[1], address)) {
+    int t = function_hit[1]; function_hit[1] = function_hit[0]; function_hit[0] = t;
+    return t;
+  }
+
+  // find the last function starting at or before the address
+  int l = 0, r = n_function - 1, i = -1;
+  while (l <= r) {
+    int mid = l + (r - l) / 2;
+    if (function_list[mid].start_address <= address) { i = mid; l = mid + 1; }
+    else r = mid - 1;
+  }
+  // walk back over the functions which may still cover the address
+  for (; i >= 0 && function_reach[i] > address; --i) {
+    if (!function_contains(i, address)) continue;
+    while (i > 0 && function_list[i - 1].start_address == function_list[i].start_address &&
+        function_contains(i - 1, address)) --i;
+    function_hit[1] = function_hit[0];
+    function_hit[0] = i;
+    return i;
+  }
   return -1;
 }
 
@@ -80,6 +145,12 @@ void add_function_trace(word_t pc, word_t target_address, enum function_trace_ty
   log_write("[ftrace]: %s %#8x <%s> from %#8x <%s>\n", ftip->type == FUNCTION_CALL ? "Call" : "Ret ",
     ftip->target_address, ftip->target_function_index  >= 0 ? function_list[ftip->target_function_index ].name : "",
     ftip->pc,             ftip->current_function_index >= 0 ? function_list[ftip->current_function_index].name : "");
+#ifdef CONFIG_FPROF
+  if (fprof_enabled) {
+    if (type == FUNCTION_CALL) fprof_call(current_function_index, target_address, target_function_index);
+    else fprof_ret();
+  }
+#endif
   function_trace_current_index = (function_trace_current_index + 1) % FUNCTION_TRACE_SIZE;
   ++n_function_trace;
   Assert(n_function_trace >= 0, "function trace count overflow");
@@ -0,0 +1,468 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/difftest.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <cpu/reverse.h>
+#include <monitor/sdb.h>
+
+#ifdef CONFIG_GDBSTUB
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* A stub of the GDB remote serial protocol. It serves one connection,
+ * and maps the breakpoints and watchpoints of gdb to the native ones,
+ * so the guest runs at full speed between the stops. A continue runs
+ * the guest in chunks and polls the socket for Ctrl-C between them.
+ */
+
+#define PACKET_SIZE 4096
+#define EXEC_CHUNK 65536
+
+bool gdb_enabled = false;
+static int listen_fd = -1;
+static int fd = -1;
+static bool no_ack = false;
+static char last_stop[64] = "S05";
+
+static char in_buf[PACKET_SIZE];
+static int in_len = 0, in_pos = 0;
+
+// the registers in the order of gdb
+static const char *gdb_reg_name[] = {
+  "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+  "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+  "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+  "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6",
+  "pc",
+};
+#define NR_GDB_REG ARRLEN(gdb_reg_name)
+// the CSRs are reported only if the ISA has them
+static const char *gdb_csr_name[] = { "mstatus", "mtvec", "mscratch", "mepc", "mcause", "satp" };
+static word_t *reg_ptr[NR_GDB_REG + ARRLEN(gdb_csr_name)];
+static int nr_reg = 0;
+static char target_xml[4096];
+
+// the points inserted by gdb
+typedef struct gdb_point {
+  int type;  // the type in the Z packet
+  vaddr_t addr;
+  word_t len;
+  int NO;
+  struct gdb_point *next;
+} GdbPoint;
+static GdbPoint *points = NULL;
+
+static void init_regs() {
+  char *p = target_xml, *end = target_xml + sizeof(target_xml);
+  p += snprintf(p, end - p,
+      "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+      "<target version=\"1.0\"><architecture>riscv:rv%d</architecture>"
+      "<feature name=\"org.gnu.gdb.riscv.cpu\">", (int)sizeof(word_t) * 8);
+  for (int i = 0; i < NR_GDB_REG; i ++) {
+    reg_ptr[nr_reg ++] = isa_reg_str2ptr(i == 0 ? "$0" : gdb_reg_name[i]);
+    Assert(reg_ptr[i] != NULL, "register %s is not found", gdb_reg_name[i]);
+    p += snprintf(p, end - p, "<reg name=\"%s\" bitsize=\"%d\" type=\"%s\"/>", gdb_reg_name[i],
+        (int)sizeof(word_t) * 8, i == 32 ? "code_ptr" : (i == 2 || i == 8) ? "data_ptr" : "int");
+  }
+  p += snprintf(p, end - p, "</feature><feature name=\"org.gnu.gdb.riscv.csr\">");
+  for (int i = 0; i < ARRLEN(gdb_csr_name); i ++) {
+    word_t *ptr = isa_reg_str2ptr(gdb_csr_name[i]);
+    if (ptr == NULL) continue;
+    reg_ptr[nr_reg ++] = ptr;
+    p += snprintf(p, end - p, "<reg name=\"%s\" bitsize=\"%d\" type=\"int\"/>",
+        gdb_csr_name[i], (int)sizeof(word_t) * 8);
+  }
+  snprintf(p, end - p, "</feature></target>");
+}
+
+void gdb_listen(const char *addr) {
+  int ret;
+  if (strncmp(addr, "unix:", 5) == 0) {
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    Assert(strlen(addr + 5) < sizeof(sa.sun_path), "socket path %s is too long", addr + 5);
+    strcpy(sa.sun_path, addr + 5);
+    unlink(sa.sun_path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ret = bind(listen_fd, (struct sockaddr *)&sa, sizeof(sa));
+  } else {
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    const char *port = strrchr(addr, ':');
+    if (port != NULL) {
+      char host[64];
+      snprintf(host, sizeof(host), "%.*s", (int)(port - addr), addr);
+      Assert(inet_pton(AF_INET, host, &sa.sin_addr) == 1, "invalid address %s", addr);
+      port ++;
+    } else port = addr;
+    sa.sin_port = htons(atoi(port));
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    ret = bind(listen_fd, (struct sockaddr *)&sa, sizeof(sa));
+  }
+  Assert(listen_fd >= 0 && ret == 0 && listen(listen_fd, 1) == 0, "can not listen on %s", addr);
+  init_regs();
+  gdb_enabled = true;
+  Log("gdb stub is listening on %s", addr);
+}
+
+static int get_char() {
+  if (in_pos == in_len) {
+    in_len = recv(fd, in_buf, sizeof(in_buf), 0);
+    in_pos = 0;
+    if (in_len <= 0) { in_len = 0; return -1; }
+  }
+  return (uint8_t)in_buf[in_pos ++];
+}
+
+static bool put_str(const char *s, int len) {
+  while (len > 0) {
+    int n = send(fd, s, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    s += n;
+    len -= n;
+  }
+  return true;
+}
+
+static int hex(int c) {
+  return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+    c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+// receive a packet into BUF, return its length, or -1 if the connection is closed
+static int recv_packet(char *buf) {
+  while (true) {
+    int c;
+    while ((c = get_char()) != '$') {
+      if (c < 0) return -1;
+    }
+    int len = 0;
+    uint8_t sum = 0;
+    while ((c = get_char()) != '#') {
+      if (c < 0) return -1;
+      if (len < PACKET_SIZE - 1) buf[len ++] = c;
+      sum += c;
+    }
+    int h = get_char(), l = get_char();
+    if (l < 0) return -1;
+    buf[len] = '\0';
+    bool ok = (hex(h) << 4 | hex(l)) == sum;
+    if (!no_ack) put_str(ok ? "+" : "-", 1);
+    if (ok || no_ack) return len;
+  }
+}
+
+static void send_packet(const char *s) {
+  static char buf[PACKET_SIZE + 5];
+  int len = strlen(s);
+  assert(len <= PACKET_SIZE);
+  uint8_t sum = 0;
+  for (int i = 0; i < len; i ++) sum += s[i];
+  buf[0] = '$';
+  memcpy(buf + 1, s, len);
+  snprintf(buf + 1 + len, 4, "#%02x", sum);
+  while (put_str(buf, len + 4) && !no_ack) {
+    int c = get_char();
+    if (c != '-') break;
+  }
+}
+
+static char *put_hex(char *p, const uint8_t *data, int len) {
+  for (int i = 0; i < len; i ++) p += sprintf(p, "%02x", data[i]);
+  return p;
+}
+
+static bool get_hex(const char **s, uint8_t *data, int len) {
+  for (int i = 0; i < len; i ++) {
+    int h = hex((*s)[0]), l = h < 0 ? -1 : hex((*s)[1]);
+    if (l < 0) return false;
+    data[i] = h << 4 | l;
+    *s += 2;
+  }
+  return true;
+}
+
+// the memory is seen as `x' sees it, through the page table of the guest
+static void read_mem(char *reply, vaddr_t addr, word_t len) {
+  uint8_t buf[PACKET_SIZE / 2];
+  if (len > sizeof(buf)) len = sizeof(buf);
+  word_t n = vaddr_copy_out(buf, addr, len);
+  if (n == 0) strcpy(reply, "E14");
+  else *put_hex(reply, buf, n) = '\0';
+}
+
+// the part of [VADDR, VADDR + LEN) in the page of VADDR is N bytes at PADDR,
+// only pmem is written, since a device register has side effects
+static bool write_range(vaddr_t vaddr, word_t len, paddr_t *paddr, word_t *n) {
+  *n = PAGE_SIZE - (vaddr & PAGE_MASK);
+  if (*n > len) *n = len;
+  return vaddr_debug_to_paddr(vaddr, paddr) && in_pmem(*paddr) && in_pmem(*paddr + *n - 1);
+}
+
+static bool write_mem(vaddr_t addr, word_t len, const char *data) {
+  uint8_t buf[PACKET_SIZE / 2];
+  if (len > sizeof(buf) || !get_hex(&data, buf, len)) return false;
+  paddr_t paddr;
+  word_t n;
+  for (word_t done = 0; done < len; done += n) {
+    if (!write_range(addr + done, len - done, &paddr, &n)) return false;
+  }
+  for (word_t done = 0; done < len; done += n) {
+    write_range(addr + done, len - done, &paddr, &n);
+    memcpy(guest_to_host(paddr), buf + done, n);
+    difftest_sync_mem(paddr, n);
+  }
+  difftest_sync_reg();
+  // the expression watchpoints may read the memory
+  wp_store(addr, len);
+  // the replay from the history would not see the change
+  IFDEF(CONFIG_REVERSE, rev_reset());
+  return true;
+}
+
+static bool insert_point(int type, vaddr_t addr, word_t len) {
+  for (GdbPoint *p = points; p != NULL; p = p->next) {
+    if (p->type == type && p->addr == addr && p->len == len) return true;
+  }
+  static const int mwp_type[] = { [2] = MWP_WRITE, [3] = MWP_READ, [4] = MWP_ACCESS };
+  int NO = type <= 1 ? add_bp(addr, NULL) : add_mwp(mwp_type[type], addr, len);
+  if (NO == 0) return false;
+  GdbPoint *p = malloc(sizeof(GdbPoint));
+  assert(p);
+  *p = (GdbPoint) { .type = type, .addr = addr, .len = len, .NO = NO, .next = points };
+  points = p;
+  return true;
+}
+
+static bool remove_point(int type, vaddr_t addr, word_t len) {
+  for (GdbPoint **pp = &points; *pp != NULL; pp = &(*pp)->next) {
+    GdbPoint *p = *pp;
+    if (p->type != type || p->addr != addr || p->len != len) continue;
+    // the point may have been deleted by `d' already
+    if (type <= 1) del_bp(p->NO);
+    else del_mwp(p->NO);
+    *pp = p->next;
+    free(p);
+    return true;
+  }
+  return false;
+}
+
+static bool interrupted() {
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  while (in_pos < in_len || poll(&pfd, 1, 0) > 0) {
+    int c = get_char();
+    if (c < 0 || c == 0x03) return true;
+  }
+  return false;
+}
+
+static void set_stop_reply(int sig) {
+  switch (nemu_state.state) {
+    case NEMU_END: snprintf(last_stop, sizeof(last_stop), "W%02x", nemu_state.halt_ret & 0xff); return;
+    case NEMU_ABORT: strcpy(last_stop, "X06"); return;
+    case NEMU_QUIT: strcpy(last_stop, "X09"); return;
+  }
+  static const char *watch[] = { "watch", "rwatch", "awatch" };
+  switch (point_stop.type) {
+    case STOP_BP: strcpy(last_stop, "T05swbreak:;"); break;
+    case STOP_MWP + MWP_READ: case STOP_MWP + MWP_WRITE: case STOP_MWP + MWP_ACCESS:
+      snprintf(last_stop, sizeof(last_stop), "T05%s:%" PRIx64 ";",
+          watch[point_stop.type - STOP_MWP == MWP_WRITE ? 0 : point_stop.type - STOP_MWP == MWP_READ ? 1 : 2],
+          (uint64_t)point_stop.addr);
+      break;
+    default: snprintf(last_stop, sizeof(last_stop), "S%02x", sig);
+  }
+}
+
+// run the guest and set the stop reply
+static void resume(bool step) {
+  int sig = 5;
+  if (nemu_state.state == NEMU_STOP || nemu_state.state == NEMU_RUNNING) {
+    point_stop.type = STOP_NONE;
+    if (step) cpu_exec(1);
+    else {
+      while (true) {
+        cpu_exec(EXEC_CHUNK);
+        if (nemu_state.state != NEMU_STOP || point_stop.type != STOP_NONE) break;
+        if (interrupted()) { sig = 2; break; }
+      }
+    }
+  }
+  set_stop_reply(sig);
+}
+
+#ifdef CONFIG_REVERSE
+static bool reverse(bool step) {
+  int ret = step ? rev_stepi(1) : rev_continue();
+  if (ret < 0) return false;
+  if (ret == 0) strcpy(last_stop, "T05replaylog:begin;");
+  else set_stop_reply(5);
+  return true;
+}
+#endif
+
+static void read_regs(char *reply) {
+  char *p = reply;
+  for (int i = 0; i < nr_reg; i ++) p = put_hex(p, (uint8_t *)reg_ptr[i], sizeof(word_t));
+  *p = '\0';
+}
+
+static bool write_reg(int i, const char **s) {
+  word_t val;
+  if (i < 0 || i >= nr_reg || !get_hex(s, (uint8_t *)&val, sizeof(val))) return false;
+  if (i != 0) *reg_ptr[i] = val;  // x0 is hardwired to zero
+  difftest_sync_reg();
+  IFDEF(CONFIG_REVERSE, rev_reset());
+  return true;
+}
+
+static void handle_query(const char *req, char *reply) {
+  const char *xfer = "qXfer:features:read:target.xml:";
+  if (strncmp(req, "qSupported", 10) == 0) {
+    sprintf(reply, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+;swbreak+;vContSupported+%s", PACKET_SIZE,
+        MUXDEF(CONFIG_REVERSE, ";ReverseStep+;ReverseContinue+", ""));
+  } else if (strncmp(req, xfer, strlen(xfer)) == 0) {
+    char *end;
+    uint64_t off = strtoull(req + strlen(xfer), &end, 16);
+    uint64_t len = strtoull(end + 1, NULL, 16);
+    uint64_t size = strlen(target_xml);
+    if (off >= size) strcpy(reply, "l");
+    else {
+      if (len > PACKET_SIZE - 1) len = PACKET_SIZE - 1;
+      if (len > size - off) len = size - off;
+      sprintf(reply, "%c%.*s", off + len == size ? 'l' : 'm', (int)len, target_xml + off);
+    }
+  } else if (strcmp(req, "qAttached") == 0) strcpy(reply, "1");
+  else if (strcmp(req, "qC") == 0) strcpy(reply, "QC1");
+  else if (strcmp(req, "qfThreadInfo") == 0) strcpy(reply, "m1");
+  else if (strcmp(req, "qsThreadInfo") == 0) strcpy(reply, "l");
+  else if (strcmp(req, "QStartNoAckMode") == 0) strcpy(reply, "OK");
+}
+
+// return false when the session is over
+static bool handle_packet(const char *req, char *reply) {
+  const char *s = req + 1;
+  char *end;
+  word_t addr, len;
+  reply[0] = '\0';
+  switch (req[0]) {
+    case '?': strcpy(reply, last_stop); break;
+    case 'q': case 'Q': handle_query(req, reply); break;
+    case 'H': case 'T': strcpy(reply, "OK"); break;
+    case 'g': read_regs(reply); break;
+    case 'G':
+      for (int i = 0; i < nr_reg && *s; i ++) {
+        if (!write_reg(i, &s)) { strcpy(reply, "E01"); return true; }
+      }
+      strcpy(reply, "OK");
+      break;
+    case 'p': {
+      int i = strtol(s, NULL, 16);
+      if (i < nr_reg) put_hex(reply, (uint8_t *)reg_ptr[i], sizeof(word_t));
+      else strcpy(reply, "E01");
+      break;
+    }
+    case 'P': {
+      int i = strtol(s, &end, 16);
+      s = end + 1;
+      strcpy(reply, *end == '=' && write_reg(i, &s) ? "OK" : "E01");
+      break;
+    }
+    case 'm':
+      addr = strtoull(s, &end, 16);
+      len = strtoull(end + 1, NULL, 16);
+      read_mem(reply, addr, len);
+      break;
+    case 'M':
+      addr = strtoull(s, &end, 16);
+      len = strtoull(end + 1, &end, 16);
+      strcpy(reply, *end == ':' && write_mem(addr, len, end + 1) ? "OK" : "E14");
+      break;
+    case 'Z': case 'z': {
+      int type = strtol(s, &end, 16);
+      addr = strtoull(end + 1, &end, 16);
+      len = strtoull(end + 1, NULL, 16);
+      if (type > 4) break;
+      if (type <= 1) len = 0;
+      bool ok = req[0] == 'Z' ? insert_point(type, addr, len) : remove_point(type, addr, len);
+      strcpy(reply, ok || req[0] == 'z' ? "OK" : "E01");
+      break;
+    }
+    case 'c': case 's':
+      if (*s) {
+        cpu.pc = strtoull(s, NULL, 16);
+        IFDEF(CONFIG_REVERSE, rev_reset());
+      }
+      resume(req[0] == 's');
+      strcpy(reply, last_stop);
+      break;
+#ifdef CONFIG_REVERSE
+    case 'b':
+      if ((req[1] == 'c' || req[1] == 's') && req[2] == '\0') {
+        strcpy(reply, reverse(req[1] == 's') ? last_stop : "E01");
+      }
+      break;
+#endif
+    case 'v':
+      if (strcmp(req, "vCont?") == 0) strcpy(reply, "vCont;c;C;s;S");
+      else if (strncmp(req, "vCont;", 6) == 0) {
+        // only one thread, so the first action applies
+        resume(req[6] == 's' || req[6] == 'S');
+        strcpy(reply, last_stop);
+      }
+      break;
+    case 'D':
+      strcpy(reply, "OK");
+      send_packet(reply);
+      return false;
+    case 'k':
+      nemu_state.state = NEMU_QUIT;
+      return false;
+  }
+  return true;
+}
+
+void gdb_mainloop() {
+  printf("Waiting for gdb to connect...\n");
+  fd = accept(listen_fd, NULL, NULL);
+  Assert(fd >= 0, "can not accept the connection from gdb");
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  static char req[PACKET_SIZE], reply[PACKET_SIZE + 1];
+  bool detach = false;
+  while (recv_packet(req) >= 0) {
+    if (!handle_packet(req, reply)) { detach = (req[0] == 'D'); break; }
+    send_packet(reply);
+    if (strcmp(req, "QStartNoAckMode") == 0) no_ack = true;
+  }
+  close(fd);
+  close(listen_fd);
+  // the guest runs to the end after gdb detaches
+  if (detach && nemu_state.state == NEMU_STOP) cpu_exec(-1);
+  else if (nemu_state.state == NEMU_STOP) nemu_state.state = NEMU_QUIT;
+}
+
+#endif
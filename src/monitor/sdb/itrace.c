@@ -14,24 +14,63 @@
 ***************************************************************************************/
 
 #include <monitor/sdb.h>
+#include <cpu/decode.h>
 
+// Only the raw instructions are kept. They are disassembled when printed.
 #define INST_HISTORY_SIZE 100
-char inst_history[INST_HISTORY_SIZE][128];
-int inst_history_count = 0;
-int inst_history_current_index = 0;
+static struct {
+  vaddr_t pc;
+  uint8_t ilen;
+  uint8_t inst[sizeof(((ISADecodeInfo *)0)->inst)];
+} inst_history[INST_HISTORY_SIZE];
+static uint64_t inst_history_count = 0;
+static int inst_history_current_index = 0;
 
-void inst_history_add(const char *s) {
-  strncpy(inst_history[inst_history_current_index], s, sizeof(inst_history[0]));
-  inst_history_current_index = (inst_history_current_index + 1) % INST_HISTORY_SIZE;
+#ifdef CONFIG_ITRACE
+void itrace_format(char *buf, int size, vaddr_t pc, const uint8_t *inst, int ilen) {
+  char *p = buf;
+  p += snprintf(p, size, FMT_WORD ":", pc);
+  int i;
+#ifdef CONFIG_ISA_x86
+  for (i = 0; i < ilen; i ++) {
+#else
+  for (i = ilen - 1; i >= 0; i --) {
+#endif
+    p += snprintf(p, 4, " %02x", inst[i]);
+  }
+  int ilen_max = MUXDEF(CONFIG_ISA_x86, 8, 4);
+  int space_len = ilen_max - ilen;
+  if (space_len < 0) space_len = 0;
+  space_len = space_len * 3 + 1;
+  memset(p, ' ', space_len);
+  p += space_len;
+
+  void disassemble(char *str, int size, uint64_t pc, uint8_t *code, int nbyte);
+  disassemble(p, buf + size - p, MUXDEF(CONFIG_ISA_x86, pc + ilen, pc), (uint8_t *)inst, ilen);
+}
+#endif
+
+void inst_history_add(vaddr_t pc, const uint8_t *inst, int ilen) {
+  int i = inst_history_current_index;
+  if (ilen > sizeof(inst_history[i].inst)) ilen = sizeof(inst_history[i].inst);
+  inst_history[i].pc = pc;
+  inst_history[i].ilen = ilen;
+  memcpy(inst_history[i].inst, inst, ilen);
+  inst_history_current_index = (i + 1) % INST_HISTORY_SIZE;
   inst_history_count += 1;
-  Assert(inst_history_count >= 0, "instruction trace count overflow");
 }
 
 void inst_history_print() {
+#ifdef CONFIG_ITRACE
   int ind = inst_history_count < INST_HISTORY_SIZE ? 0 : inst_history_current_index;
   int n = inst_history_count < INST_HISTORY_SIZE ? inst_history_current_index : INST_HISTORY_SIZE;
+  char buf[128];
   for (int i = 0; i < n; ++i) {
-    printf("%s\n", inst_history[ind]);
+    itrace_format(buf, sizeof(buf), inst_history[ind].pc, inst_history[ind].inst, inst_history[ind].ilen);
+    printf("%s\n", buf);
     ind = (ind + 1) % INST_HISTORY_SIZE;
   }
+#else
+  printf("instruction trace is not enabled\n");
+#endif
 }
@@ -0,0 +1,147 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <monitor/sdb.h>
+
+#ifdef CONFIG_MEMWATCH
+
+/* Memory access watchpoints are checked by the guest loads and stores
+ * themselves. Every watched page sets a bit in the bitmap of its access
+ * type, so an access to an unwatched page costs one bit test. The page
+ * before the range is also marked, since an access starting there may
+ * cross into the range.
+ */
+
+#define MAX_ACCESS_LEN 8
+
+typedef struct mem_watchpoint {
+  int NO;
+  int type;  // MWP_READ, MWP_WRITE or both
+  vaddr_t addr;
+  word_t len;
+  uint64_t hit;
+  struct mem_watchpoint *next;
+} MWP;
+
+static MWP *head = NULL;
+uint8_t mwp_bitmap[2][MWP_BITMAP_BITS / 8] = {};
+
+MWPHit mwp_pending = {};
+
+static const char *type_name(int type) {
+  return type == MWP_READ ? "read" : type == MWP_WRITE ? "write" : "access";
+}
+
+static void set_bits(MWP *mwp) {
+  vaddr_t lo = mwp->addr - (mwp->addr >= MAX_ACCESS_LEN - 1 ? MAX_ACCESS_LEN - 1 : mwp->addr);
+  for (uint64_t page = lo >> 12; page <= (mwp->addr + mwp->len - 1) >> 12; page ++) {
+    uint32_t idx = page & (MWP_BITMAP_BITS - 1);
+    for (int t = 0; t < 2; t ++) {
+      if (mwp->type & (1 << t)) mwp_bitmap[t][idx / 8] |= 1 << (idx % 8);
+    }
+    if (page - (lo >> 12) >= MWP_BITMAP_BITS) break;
+  }
+}
+
+static void print_mwp(MWP *mwp) {
+  printf("No.%d %s [" FMT_WORD ", " FMT_WORD "], hit %" PRIu64 " time(s)\n",
+      mwp->NO, type_name(mwp->type), mwp->addr, mwp->addr + mwp->len - 1, mwp->hit);
+}
+
+// return the number of the new watchpoint, 0 on failure
+int add_mwp(int type, vaddr_t addr, word_t len) {
+  if (len == 0 || addr + len - 1 < addr) {
+    printf("invalid range\n");
+    return 0;
+  }
+  MWP *mwp = calloc(1, sizeof(MWP));
+  assert(mwp);
+  *mwp = (MWP) { .NO = new_point_NO(), .type = type, .addr = addr, .len = len };
+  MWP **p = &head;
+  while (*p != NULL) p = &(*p)->next;
+  *p = mwp;
+  set_bits(mwp);
+  printf("%s watchpoint ", type_name(type));
+  print_mwp(mwp);
+  return mwp->NO;
+}
+
+bool del_mwp(int n) {
+  for (MWP **p = &head; *p != NULL; p = &(*p)->next) {
+    MWP *mwp = *p;
+    if (mwp->NO != n) continue;
+    *p = mwp->next;
+    if (mwp_pending.mwp == mwp) mwp_pending.mwp = NULL;
+    free(mwp);
+    memset(mwp_bitmap, 0, sizeof(mwp_bitmap));
+    for (mwp = head; mwp != NULL; mwp = mwp->next) set_bits(mwp);
+    return true;
+  }
+  return false;
+}
+
+void display_mwp() {
+  if (head == NULL) return;
+  printf("Memory watchpoints\n");
+  for (MWP *mwp = head; mwp != NULL; mwp = mwp->next) print_mwp(mwp);
+}
+
+/* Called by the guest access of [addr, addr + len) on a marked page.
+ * The state of NEMU is not changed here, since the access is not done yet
+ * and the device logs only take the accesses of a running guest;
+ * `execute()' stops after the instruction when there is a pending hit.
+ */
+void mwp_access(int type, vaddr_t addr, int len, word_t data) {
+  if (nemu_state.state != NEMU_RUNNING) return;
+  for (MWP *mwp = head; mwp != NULL; mwp = mwp->next) {
+    // compare the last bytes, since a range may end at the top of the address space
+    if (!(mwp->type & type) || addr > mwp->addr + mwp->len - 1 || mwp->addr > addr + len - 1) continue;
+    if (!point_quiet) mwp->hit ++;
+    if (mwp_pending.mwp == NULL) {
+      mwp_pending.mwp = mwp;
+      mwp_pending.type = type;
+      mwp_pending.addr = addr;
+      mwp_pending.len = len;
+      mwp_pending.data = data;
+      mwp_pending.pc = cpu.pc;
+      point_stop = (PointStop) { .type = STOP_MWP + mwp->type, .addr = addr > mwp->addr ? addr : mwp->addr };
+    }
+  }
+}
+
+// report the watchpoint hit by the last instruction S
+void mwp_report(Decode *s) {
+  if (mwp_pending.mwp == NULL) return;
+  if (point_quiet) { mwp_pending.mwp = NULL; return; }
+  int f = search_function(mwp_pending.pc);
+  printf("hit %s watchpoint No.%d: %s %d byte(s) at " FMT_WORD,
+      type_name(mwp_pending.mwp->type), mwp_pending.mwp->NO, type_name(mwp_pending.type), mwp_pending.len, mwp_pending.addr);
+  if (mwp_pending.type == MWP_WRITE) printf(" = " FMT_WORD, mwp_pending.data);
+  printf(", by pc = " FMT_WORD " <%s>\n", mwp_pending.pc, f >= 0 ? function_list[f].name : "");
+#ifdef CONFIG_ITRACE
+  if (s->pc == mwp_pending.pc) {
+    char buf[128];
+    itrace_format(buf, sizeof(buf), s->pc, (uint8_t *)&s->isa.inst, s->snpc - s->pc);
+    printf("%s\n", buf);
+  }
+#endif
+  mwp_pending.mwp = NULL;
+}
+
+#endif
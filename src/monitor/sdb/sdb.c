@@ -21,10 +21,19 @@
 #include <memory/vaddr.h>
 #include <memory/paddr.h>
 #include <cpu/difftest.h>
+#include <cpu/reverse.h>
+#include <signal.h>
+#ifdef CONFIG_SDB_THREAD
+#include <pthread.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#endif
 
 static int is_batch_mode = false;
+static const char *script_file = NULL;
+static bool is_mi_mode = false;
+extern uint64_t g_nr_guest_inst;
 
-void init_regex();
 void init_wp_pool();
 
 /* We use the `readline' library to provide more flexibility to read from stdin. */
@@ -45,11 +54,86 @@ static char* rl_gets() {
   return line_read;
 }
 
+#ifdef CONFIG_SDB_THREAD
+/* The prompt is served by a thread, so sdb takes commands while the guest
+ * is running. The commands are still executed by the main thread, which
+ * also owns the SDL window of the devices: `c' hands the prompt back
+ * before running the guest, `pause', `status' and `q' are taken at once,
+ * and the other commands are queued until the guest stops. `pause' and `q'
+ * drop the queued commands.
+ */
+typedef struct SdbLine {
+  char *str;              // NULL for EOF
+  uint64_t seq;
+  struct SdbLine *next;
+} SdbLine;
+
+static pthread_t sdb_thread;
+static bool sdb_threaded = false;
+static pthread_mutex_t sdb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sdb_cond = PTHREAD_COND_INITIALIZER;
+static SdbLine *sdb_queue = NULL, **sdb_queue_tail = &sdb_queue;  // posted to the main thread
+static uint64_t sdb_nr_post = 0;
+static uint64_t sdb_nr_done = 0;  // the lines before are done or run the guest in the background
+static uint64_t sdb_cur = 0;      // the line executed by the main thread
+static bool sdb_busy = false;     // the main thread is executing a command
+static bool sdb_detached = false; // ... which runs the guest in the background
+static bool sdb_quit = false;
+static atomic_bool sdb_redraw = false;
+static uint64_t last_inst = 0, last_time = 0;
+
+// called by `c' before running the guest
+static void sdb_detach() {
+  if (!sdb_threaded) return;
+  pthread_mutex_lock(&sdb_lock);
+  sdb_detached = true;
+  sdb_nr_done = sdb_cur;
+  last_inst = g_nr_guest_inst;
+  last_time = get_time();
+  pthread_cond_broadcast(&sdb_cond);
+  pthread_mutex_unlock(&sdb_lock);
+}
+#endif
+
+// `running' is true when called by the prompt thread with the guest running
+static void report_progress(const char *what, bool running) {
+  // this may race with the running guest, which is fine for a report
+  uint64_t inst = g_nr_guest_inst;
+  vaddr_t pc = cpu.pc;
+  printf("%s at instruction %" PRIu64 ", pc = " FMT_WORD, what, inst, pc);
+  // the function lookup updates the cache shared with the guest, so it is left
+  // to the thread running the guest
+  if (!running) {
+    int f = search_function(pc);
+    if (f >= 0) printf(" <%s>", function_list[f].name);
+  }
+#ifdef CONFIG_SDB_THREAD
+  uint64_t now = get_time();
+  if (running && now > last_time) {
+    printf(", %" PRIu64 " inst/s", (inst - last_inst) * 1000000 / (now - last_time));
+  }
+  last_inst = inst;
+  last_time = now;
+#endif
+  printf("\n");
+}
+
 static int cmd_c(char *args) {
+  IFDEF(CONFIG_SDB_THREAD, sdb_detach());
   cpu_exec(-1);
   return 0;
 }
 
+// only reached when the guest is not running, see `sdb_prompt()'
+static int cmd_pause(char *args) {
+  printf("the guest is not running\n");
+  return 0;
+}
+
+static int cmd_status(char *args) {
+  report_progress("stopped", false);
+  return 0;
+}
 
 static int cmd_q(char *args) {
   if (nemu_state.state != NEMU_END && nemu_state.state != NEMU_ABORT) {
@@ -79,6 +163,42 @@ static int cmd_si(char *args) {
   return 0;
 }
 
+#ifdef CONFIG_REVERSE
+static void rev_report(int ret) {
+  if (ret < 0) {
+    printf("no execution history\n");
+    return;
+  }
+  if (ret == 0) printf("reached the beginning of the history\n");
+  int f = search_function(cpu.pc);
+  printf("instruction %" PRIu64 ", pc = " FMT_WORD " <%s>\n", g_nr_guest_inst, cpu.pc,
+      f >= 0 ? function_list[f].name : "");
+}
+#endif
+
+static int cmd_rsi(char *args) {
+#ifdef CONFIG_REVERSE
+  uint64_t step = 1;
+  if (args != NULL && (sscanf(args, "%" SCNu64, &step) != 1 || step == 0)) {
+    printf("format: rsi [N]\n");
+    return 0;
+  }
+  rev_report(rev_stepi(step));
+#else
+  printf("reverse execution is not enabled\n");
+#endif
+  return 0;
+}
+
+static int cmd_rc(char *args) {
+#ifdef CONFIG_REVERSE
+  rev_report(rev_continue());
+#else
+  printf("reverse execution is not enabled\n");
+#endif
+  return 0;
+}
+
 static int cmd_info(char *args) {
   char *str = strtok(args, " ");
   if (str == NULL || strtok(NULL, " ") != NULL) {
@@ -89,6 +209,11 @@ static int cmd_info(char *args) {
     isa_reg_display();
   } else if (strcmp(str, "w") == 0) {
     display_wp();
+  } else if (strcmp(str, "b") == 0) {
+    IFDEF(CONFIG_BREAKPOINT, display_bp());
+  } else if (strcmp(str, "stats") == 0) {
+    IFDEF(CONFIG_ISTAT, istat_display());
+    IFNDEF(CONFIG_ISTAT, printf("instruction statistics are not enabled\n"));
   } else {
     printf("unsupported subcmd %s\n", str);
     return 0;
@@ -107,46 +232,123 @@ static int cmd_p(char *args) {
   return 0;
 }
 
-void exam_memory(vaddr_t address, int n) {
-  while (n > 0) {
-    printf(FMT_PADDR ":", address);
-    for (int i = 0; i < 8 && n > 0; i++, n--) {
-      printf(" %02" PRIx8, vaddr_read(address + i, 1));
+#define EXAM_CHUNK 4096
+
+// show N units of SIZE bytes in FMT (x, d or u), the memory is read in chunks
+void exam_memory(vaddr_t address, word_t n, int size, char fmt) {
+  static uint8_t buf[EXAM_CHUNK];
+  char line[256], *p = line;
+  int per_line = (size == 1 ? 8 : 16 / size);
+  uint64_t total = (uint64_t)n * size;
+  for (uint64_t off = 0; off < total; ) {
+    word_t len = (total - off < EXAM_CHUNK ? total - off : EXAM_CHUNK);
+    word_t got = vaddr_copy_out(buf, address + off, len);
+    for (word_t i = 0; i + size <= got; i += size) {
+      if (i / size % per_line == 0) p = line + sprintf(line, FMT_PADDR ":", (vaddr_t)(address + off + i));
+      uint64_t v = 0;
+      memcpy(&v, buf + i, size);
+      int shift = 64 - size * 8;
+      switch (fmt) {
+        case 'd': p += sprintf(p, " %" PRId64, (int64_t)(v << shift) >> shift); break;
+        case 'u': p += sprintf(p, " %" PRIu64, v); break;
+        default:  p += sprintf(p, " %0*" PRIx64, size * 2, v); break;
+      }
+      if (i / size % per_line == per_line - 1 || i + size * 2 > got) puts(line);
     }
-    printf("\n");
-    address += 8;
+    if (got < len) {
+      printf("can not access memory at " FMT_PADDR "\n", (vaddr_t)(address + off + got));
+      return;
+    }
+    off += got;
   }
 }
 
 static int cmd_x(char *args) {
   if (args == NULL) {
-    printf("format: x N <expr>\n");
+    printf("format: x N <expr>, or x/NFU <expr>\n");
     return 0;
   }
-  char *args_end = args + strlen(args);
-  char *str = strtok(args, " ");
-  if (str == NULL) {
-    printf("command x miss argument N\n");
-    return 0;
+  word_t n = 1;
+  int size = 1;
+  char fmt = 'x';
+  char *str;
+  if (args[0] == '/') {
+    // N units of U (b, h, w or g) bytes shown in F (x, d or u), like gdb
+    char *p = args + 1;
+    if (isdigit((unsigned char)*p)) n = strtoul(p, &p, 10);
+    for (; *p != '\0' && *p != ' '; p ++) {
+      const char *unit = strchr("bhwg", *p);
+      if (unit != NULL) size = 1 << (unit - "bhwg");
+      else if (strchr("xdu", *p) != NULL) fmt = *p;
+      else {
+        printf("unknown format letter '%c'\n", *p);
+        return 0;
+      }
+    }
+    str = p;
+  } else {
+    char *args_end = args + strlen(args);
+    str = strtok(args, " ");
+    if (str == NULL) {
+      printf("command x miss argument N\n");
+      return 0;
+    }
+    n = atoi(str);
+    str += strlen(str) + 1;
+    if (str > args_end) {
+      printf("command x miss start address\n");
+      return 0;
+    }
   }
-  int n = atoi(str);
   if (n == 0) {
     printf("parse N error\n");
     return 0;
   }
-  str += strlen(str) + 1;
-  if (str > args_end) {
-    printf("command x miss start address\n");
-    return 0;
-  }
   bool success = true;
   word_t address = expr(str, &success);
   if (!success) {
     printf("address expression error\n");
     return 0;
   }
-  printf("cmd x %d " FMT_PADDR "\n", n, address);
-  exam_memory(address, n);
+  printf("cmd x %" PRIu64 " " FMT_PADDR "\n", (uint64_t)n, address);
+  exam_memory(address, n, size, fmt);
+  return 0;
+}
+
+static int cmd_dump(char *args) {
+  char *addr_str = strtok(args, " ");
+  char *len_str = strtok(NULL, " ");
+  char *file = strtok(NULL, " ");
+  if (file == NULL || strtok(NULL, " ") != NULL) {
+    printf("format: dump ADDR LEN FILE\n");
+    return 0;
+  }
+  bool success = true;
+  word_t address = expr(addr_str, &success);
+  word_t len = (success ? expr(len_str, &success) : 0);
+  if (!success) {
+    printf("expression error\n");
+    return 0;
+  }
+  FILE *fp = fopen(file, "wb");
+  if (fp == NULL) {
+    printf("can not open '%s'\n", file);
+    return 0;
+  }
+  static uint8_t buf[64 * 1024];
+  word_t done = 0;
+  while (done < len) {
+    word_t n = (len - done < sizeof(buf) ? len - done : sizeof(buf));
+    word_t got = vaddr_copy_out(buf, address + done, n);
+    fwrite(buf, 1, got, fp);
+    done += got;
+    if (got < n) {
+      printf("can not access memory at " FMT_PADDR "\n", (vaddr_t)(address + done));
+      break;
+    }
+  }
+  fclose(fp);
+  printf("%" PRIu64 " byte(s) at " FMT_PADDR " are written to %s\n", (uint64_t)done, address, file);
   return 0;
 }
 
@@ -165,7 +367,71 @@ static int cmd_d(char *args) {
     printf("invalid watchpoint ID\n");
     return 0;
   }
-  del_wp(n);
+  bool deleted = del_wp(n);
+#ifdef CONFIG_BREAKPOINT
+  deleted = deleted || del_bp(n);
+#endif
+#ifdef CONFIG_MEMWATCH
+  deleted = deleted || del_mwp(n);
+#endif
+  if (!deleted) printf("watchpoint or breakpoint %d does not exist\n", n);
+  return 0;
+}
+
+static int mem_watch(char *args, int type) {
+#ifdef CONFIG_MEMWATCH
+  if (args == NULL) {
+    printf("format: watch ADDR[, LEN]\n");
+    return 0;
+  }
+  word_t len = 4;
+  char *comma = strchr(args, ',');
+  bool success = true;
+  if (comma != NULL) {
+    *comma = '\0';
+    len = expr(comma + 1, &success);
+    if (!success) {
+      printf("length expression error\n");
+      return 0;
+    }
+  }
+  word_t addr = expr(args, &success);
+  if (!success) {
+    printf("address expression error\n");
+    return 0;
+  }
+  add_mwp(type, addr, len);
+#else
+  printf("memory watchpoint is not enabled\n");
+#endif
+  return 0;
+}
+
+static int cmd_watch(char *args) { return mem_watch(args, MWP_WRITE); }
+static int cmd_rwatch(char *args) { return mem_watch(args, MWP_READ); }
+static int cmd_awatch(char *args) { return mem_watch(args, MWP_ACCESS); }
+
+static int cmd_b(char *args) {
+#ifdef CONFIG_BREAKPOINT
+  if (args == NULL) {
+    printf("format: b ADDR [if COND]\n");
+    return 0;
+  }
+  char *cond = strstr(args, " if ");
+  if (cond != NULL) {
+    *cond = '\0';
+    cond += 4;
+  }
+  bool success = true;
+  word_t pc = expr(args, &success);
+  if (!success) {
+    printf("address expression error\n");
+    return 0;
+  }
+  add_bp(pc, cond);
+#else
+  printf("breakpoint is not enabled\n");
+#endif
   return 0;
 }
 
@@ -179,6 +445,41 @@ static int cmd_ftrace(char *args) {
   return 0;
 }
 
+static int cmd_trace(char *args) {
+#ifdef CONFIG_BTRACE
+  char *str = (args == NULL ? NULL : strtok(args, " "));
+  if (str == NULL) {
+    btrace_display();
+  } else if (strcmp(str, "dump") == 0) {
+    char *file_name = strtok(NULL, " ");
+    if (file_name == NULL) {
+      printf("format: trace dump FILE\n");
+      return 0;
+    }
+    btrace_dump(file_name);
+  } else {
+    btrace_set_mask(str);
+  }
+#else
+  printf("binary trace is not enabled\n");
+#endif
+  return 0;
+}
+
+static int cmd_fprof(char *args) {
+#ifdef CONFIG_FPROF
+  int n = 20;
+  if (args != NULL && sscanf(args, "%d", &n) != 1) {
+    printf("format: fprof [N]\n");
+    return 0;
+  }
+  fprof_display(n);
+#else
+  printf("function profiler is not enabled\n");
+#endif
+  return 0;
+}
+
 static int cmd_fstack(char *args) {
   print_function_stack();
   return 0;
@@ -244,6 +545,7 @@ static int cmd_load(char *args) {
   function_stack_load(fp);
   fclose(fp);
   difftest_load();
+  IFDEF(CONFIG_REVERSE, rev_reset());
   return 0;
 }
 
@@ -294,15 +596,26 @@ static struct {
   { "help", "Display information about all supported commands", cmd_help },
   { "c", "Continue the execution of the program", cmd_c },
   { "q", "Exit NEMU", cmd_q },
+  { "pause", "Stop the guest started by `c'", cmd_pause },
+  { "status", "Show the instruction count, the pc and the speed of the guest", cmd_status },
   { "si", "Single step N times", cmd_si },
+  { "rsi", "Step back N instructions, `rsi [N]'", cmd_rsi },
+  { "rc", "Continue backwards to the last breakpoint or watchpoint hit", cmd_rc },
   { "info", "Show info", cmd_info },
   { "p", "Evaluate expression", cmd_p },
-  { "x", "Show memory", cmd_x },
+  { "x", "Show memory, `x N EXPR' for N bytes, or `x/NFU EXPR' for N units of U (b, h, w, g) in F (x, d, u)", cmd_x },
+  { "dump", "Write the memory to a file, `dump ADDR LEN FILE'", cmd_dump },
   { "w", "Set watch point", cmd_w },
-  { "d", "Delete watch point", cmd_d },
+  { "b", "Set breakpoint at ADDR (an expression, e.g. a symbol), `b ADDR [if COND]'", cmd_b },
+  { "watch", "Stop when the guest writes [ADDR, ADDR + LEN), `watch ADDR[, LEN]'", cmd_watch },
+  { "rwatch", "Stop when the guest reads [ADDR, ADDR + LEN), `rwatch ADDR[, LEN]'", cmd_rwatch },
+  { "awatch", "Stop when the guest accesses [ADDR, ADDR + LEN), `awatch ADDR[, LEN]'", cmd_awatch },
+  { "d", "Delete watch point or breakpoint", cmd_d },
   { "itrace", "Print instruction trace", cmd_itrace },
   { "ftrace", "Print function trace", cmd_ftrace },
+  { "trace", "Show binary trace, select categories with `trace inst,mem', or `trace dump FILE'", cmd_trace },
   { "fstack", "Print function stack", cmd_fstack },
+  { "fprof", "Show the top N functions of the function profile, `fprof [N]'", cmd_fprof },
   { "detach", "Disable difftest", cmd_detach},
   { "attach", "Enable difftest", cmd_attach},
   { "save", "Save snapshot", cmd_save},
@@ -338,52 +651,280 @@ static int cmd_help(char *args) {
   return 0;
 }
 
-void sdb_set_batch_mode() {
-  is_batch_mode = true;
+/* Execute a command line, return a negative value to exit sdb,
+ * or a positive value if the command is unknown.
+ */
+static int sdb_exec(char *str) {
+  char *str_end = str + strlen(str);
+
+  /* extract the first token as the command */
+  char *cmd = strtok(str, " ");
+  if (cmd == NULL) { return 0; }
+
+  /* treat the remaining string as the arguments,
+   * which may need further parsing
+   */
+  char *args = cmd + strlen(cmd) + 1;
+  if (args >= str_end) {
+    args = NULL;
+  }
+
+  /* `x/FMT EXPR' is `x' with the arguments `/FMT EXPR' */
+  size_t cmd_len = strlen(cmd);
+  char *slash = strchr(cmd, '/');
+  if (slash != NULL) {
+    if (args != NULL) args[-1] = ' ';
+    args = slash;
+    cmd_len = slash - cmd;
+  }
+
+#ifdef CONFIG_DEVICE
+  extern void sdl_clear_event_queue();
+  sdl_clear_event_queue();
+#endif
+
+  for (int i = 0; i < NR_CMD; i ++) {
+    if (strncmp(cmd, cmd_table[i].name, cmd_len) == 0 && cmd_table[i].name[cmd_len] == '\0') {
+      return cmd_table[i].handler(args) < 0 ? -1 : 0;
+    }
+  }
+
+  printf("Unknown command '%.*s'\n", (int)cmd_len, cmd);
+  return 1;
 }
 
-void sdb_mainloop() {
-  if (is_batch_mode) {
-    cmd_c(NULL);
+static void mi_print_str(const char *s) {
+  putchar('"');
+  for (; *s != '\0'; s ++) {
+    if (*s == '"' || *s == '\\') putchar('\\');
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+// the result record of the command at LINENO in the machine-readable mode
+static void mi_done(int lineno, int ret) {
+  static const char *state[] = {
+    [NEMU_RUNNING] = "running", [NEMU_STOP] = "stop", [NEMU_END] = "end",
+    [NEMU_ABORT] = "abort", [NEMU_QUIT] = "quit",
+  };
+  static const char *reason[] = {
+    [STOP_WP] = "watchpoint", [STOP_BP] = "breakpoint",
+    [STOP_MWP + MWP_READ] = "rwatch", [STOP_MWP + MWP_WRITE] = "watch", [STOP_MWP + MWP_ACCESS] = "awatch",
+  };
+  if (ret > 0) {
+    printf("^error,line=%d,msg=\"unknown command\"\n", lineno);
     return;
   }
+  printf("^done,line=%d,state=%s,pc=" FMT_WORD ",inst=%" PRIu64,
+      lineno, state[nemu_state.state], cpu.pc, g_nr_guest_inst);
+  if (point_stop.type != STOP_NONE) printf(",reason=%s", reason[point_stop.type]);
+  if (point_stop.type > STOP_WP) printf(",addr=" FMT_WORD, point_stop.addr);
+  if (nemu_state.state == NEMU_END || nemu_state.state == NEMU_ABORT) {
+    printf(",halt_pc=" FMT_WORD ",halt_ret=%d", nemu_state.halt_pc, nemu_state.halt_ret);
+  }
+  printf("\n");
+}
 
-  for (char *str; (str = rl_gets()) != NULL; ) {
-    char *str_end = str + strlen(str);
-
-    /* extract the first token as the command */
-    char *cmd = strtok(str, " ");
-    if (cmd == NULL) { continue; }
-
-    /* treat the remaining string as the arguments,
-     * which may need further parsing
-     */
-    char *args = cmd + strlen(cmd) + 1;
-    if (args >= str_end) {
-      args = NULL;
+/* Run the commands in the script file ("-" for stdin) without readline.
+ * Empty lines and lines starting with `#' are skipped, and the end of the
+ * script works as `q'. In the machine-readable mode, the output of each
+ * command is put between a `^cmd' record with the command and a `^done'
+ * (or `^error') record with the state of the guest after it.
+ */
+static void sdb_run_script() {
+  FILE *fp = (strcmp(script_file, "-") == 0 ? stdin : fopen(script_file, "r"));
+  Assert(fp, "Can not open '%s'", script_file);
+  char *line = NULL;
+  size_t size = 0;
+  int ret = 0;
+  for (int lineno = 1; ret >= 0 && getline(&line, &size, fp) != -1; lineno ++) {
+    line[strcspn(line, "\r\n")] = '\0';
+    char *str = line + strspn(line, " \t");
+    if (*str == '\0' || *str == '#') continue;
+    if (is_mi_mode) {
+      printf("^cmd,line=%d,text=", lineno);
+      mi_print_str(str);
+      printf("\n");
+    } else {
+      printf("(nemu) %s\n", str);
     }
+    fflush(stdout);
+    point_stop.type = STOP_NONE;
+    ret = sdb_exec(str);
+    if (is_mi_mode) mi_done(lineno, ret);
+    fflush(stdout);
+  }
+  free(line);
+  if (fp != stdin) fclose(fp);
+  if (ret >= 0) cmd_q(NULL);
+}
 
-#ifdef CONFIG_DEVICE
-    extern void sdl_clear_event_queue();
-    sdl_clear_event_queue();
-#endif
+static void sdb_sigint(int signum) {
+  if (nemu_state.state == NEMU_RUNNING) cpu_request_stop();
+}
 
-    int i;
-    for (i = 0; i < NR_CMD; i ++) {
-      if (strcmp(cmd, cmd_table[i].name) == 0) {
-        if (cmd_table[i].handler(args) < 0) { return; }
-        break;
+#ifdef CONFIG_SDB_THREAD
+// drop the lines queued while the guest is running, called with `sdb_lock' held
+static void sdb_drop_queue() {
+  while (sdb_queue != NULL) {
+    SdbLine *l = sdb_queue;
+    sdb_queue = l->next;
+    free(l->str);
+    free(l);
+  }
+  sdb_queue_tail = &sdb_queue;
+}
+
+// post a command line (NULL for EOF) to the main thread, if the main thread is
+// busy with the prompt on a terminal, it is queued, otherwise wait until it is
+// done or runs the guest, return false if sdb exits
+static bool sdb_post(char *line) {
+  SdbLine *l = malloc(sizeof(*l));
+  assert(l);
+  pthread_mutex_lock(&sdb_lock);
+  // a script is not read ahead, its commands are executed in order anyway
+  bool queued = (sdb_busy || sdb_queue != NULL) && line != NULL && isatty(STDIN_FILENO);
+  if (queued) {
+    printf("the guest is running, the command is queued until it stops, `pause' drops it\n");
+  }
+  // `l' is freed by the main thread once it is taken
+  uint64_t seq = ++ sdb_nr_post;
+  *l = (SdbLine) { .str = line, .seq = seq, .next = NULL };
+  *sdb_queue_tail = l;
+  sdb_queue_tail = &l->next;
+  pthread_cond_broadcast(&sdb_cond);
+  while (!queued && !sdb_quit && sdb_nr_done < seq) pthread_cond_wait(&sdb_cond, &sdb_lock);
+  bool quit = sdb_quit;
+  pthread_mutex_unlock(&sdb_lock);
+  return !quit;
+}
+
+// show the prompt again after the messages printed when the guest stops
+static int sdb_redraw_hook() {
+  if (atomic_exchange(&sdb_redraw, false)) rl_forced_update_display();
+  return 0;
+}
+
+static void *sdb_prompt(void *arg) {
+  // the timers of the devices and the profiler interrupt the main thread
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGVTALRM);
+  sigaddset(&set, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+  rl_event_hook = sdb_redraw_hook;
+
+  for (char *str; (str = rl_gets()) != NULL; ) {
+    char cmd[16] = "";
+    sscanf(str, "%15s", cmd);
+    pthread_mutex_lock(&sdb_lock);
+    if (sdb_busy) {
+      if (strcmp(cmd, "status") == 0) {
+        report_progress("running", true);
+        pthread_mutex_unlock(&sdb_lock);
+        continue;
+      }
+      if (strcmp(cmd, "pause") == 0) {
+        sdb_drop_queue();
+        cpu_request_stop();
+        while (sdb_busy) pthread_cond_wait(&sdb_cond, &sdb_lock);
+        sdb_redraw = false;
+        report_progress("paused", false);
+        pthread_mutex_unlock(&sdb_lock);
+        continue;
+      }
+      if (strcmp(cmd, "q") == 0) {
+        sdb_drop_queue();
+        cpu_request_stop();
+        while (sdb_busy) pthread_cond_wait(&sdb_cond, &sdb_lock);
       }
     }
+    pthread_mutex_unlock(&sdb_lock);
+    if (!sdb_post(strdup(str))) return NULL;
+  }
+  sdb_post(NULL);
+  return NULL;
+}
 
-    if (i == NR_CMD) { printf("Unknown command '%s'\n", cmd); }
+// executed by the main thread
+static void sdb_serve() {
+  while (true) {
+    pthread_mutex_lock(&sdb_lock);
+    while (sdb_queue == NULL) pthread_cond_wait(&sdb_cond, &sdb_lock);
+    SdbLine *l = sdb_queue;
+    sdb_queue = l->next;
+    if (sdb_queue == NULL) sdb_queue_tail = &sdb_queue;
+    char *line = l->str;
+    sdb_cur = l->seq;
+    sdb_busy = true;
+    sdb_detached = false;
+    free(l);
+    pthread_mutex_unlock(&sdb_lock);
+
+    int ret = (line == NULL ? -1 : sdb_exec(line));
+    free(line);
+
+    pthread_mutex_lock(&sdb_lock);
+    if (sdb_detached) sdb_redraw = true;
+    sdb_busy = false;
+    sdb_nr_done = sdb_cur;
+    sdb_quit = (ret < 0);
+    pthread_cond_broadcast(&sdb_cond);
+    pthread_mutex_unlock(&sdb_lock);
+    if (ret < 0) return;
   }
 }
+#endif
 
-void init_sdb() {
-  /* Compile the regular expressions. */
-  init_regex();
+void sdb_set_batch_mode() {
+  is_batch_mode = true;
+}
 
+void sdb_set_script(const char *file) {
+  script_file = file;
+}
+
+void sdb_set_mi_mode() {
+  is_mi_mode = true;
+}
+
+void sdb_mainloop() {
+#ifdef CONFIG_GDBSTUB
+  if (gdb_enabled) {
+    gdb_mainloop();
+    return;
+  }
+#endif
+  if (script_file != NULL) {
+    sdb_run_script();
+    return;
+  }
+  if (is_batch_mode) {
+    cmd_c(NULL);
+    return;
+  }
+
+  /* Ctrl-C stops the guest instead of killing NEMU. */
+  struct sigaction sa = { .sa_handler = sdb_sigint, .sa_flags = SA_RESTART };
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  rl_catch_signals = 0;
+
+#ifdef CONFIG_SDB_THREAD
+  sdb_threaded = true;
+  int ret = pthread_create(&sdb_thread, NULL, sdb_prompt, NULL);
+  Assert(ret == 0, "Can not create the sdb thread");
+  sdb_serve();
+  pthread_join(sdb_thread, NULL);
+#else
+  for (char *str; (str = rl_gets()) != NULL; ) {
+    if (sdb_exec(str) < 0) { return; }
+  }
+#endif
+}
+
+void init_sdb() {
   /* Initialize the watchpoint pool. */
   init_wp_pool();
 }
@@ -15,50 +15,82 @@
 
 #include <monitor/sdb.h>
 
-#define NR_WP 32
+/* The expression of a watchpoint is compiled once. It is evaluated again
+ * only when one of its inputs may have changed: a register it reads has
+ * a new value, or a store hits a memory location read by the last
+ * evaluation. The memory locations are collected in every evaluation,
+ * since the address may depend on the registers, e.g. `*($sp + 4)'.
+ */
+
+typedef struct {
+  word_t *ptr;
+  word_t val;
+} WPReg;
+
+typedef struct {
+  vaddr_t addr;
+  int len;
+} WPMem;
 
 typedef struct watchpoint {
-  int idx; // for debug
   int NO;
-  char expr[256];
+  char *expr;
+  ExprCode code;
   word_t value;
+  bool dirty;
+  bool always;  // reads a register which can only be accessed by name
+  WPReg *reg;
+  int nr_reg;
+  WPMem *mem;
+  int nr_mem, mem_size;
   struct watchpoint *next;
   struct watchpoint *prev;
-  /* TODO: Add more members if necessary */
-
 } WP;
 
-static WP wp_pool[NR_WP] = {};
-static WP *head = NULL, *free_ = NULL;
+static WP *head = NULL;
 static int wp_seq = 0;
+int wp_nr_mem = 0;
+PointStop point_stop = {};
+bool point_quiet = false;
 
-void init_wp_pool() {
-  int i;
-  for (i = 0; i < NR_WP; i ++) {
-    wp_pool[i].idx = i;
-    wp_pool[i].NO = 0;
-    wp_pool[i].next = (i == NR_WP - 1 ? NULL : &wp_pool[i + 1]);
-    wp_pool[i].prev = (i == 0 ? NULL : &wp_pool[i - 1]);
-  }
+// watchpoints and breakpoints share the numbers
+int new_point_NO() {
+  return ++wp_seq;
+}
 
+void init_wp_pool() {
+  while (head != NULL) del_wp(head->NO);
   head = NULL;
-  free_ = wp_pool;
   wp_seq = 0;
 }
 
-/* TODO: Implement the functionality of watchpoint */
+static void count_mem() {
+  wp_nr_mem = 0;
+  for (WP *p = head; p != NULL; p = p->next) wp_nr_mem += p->nr_mem;
+}
+
+static void record_read(void *arg, vaddr_t addr, int len) {
+  WP *wp = arg;
+  if (wp->nr_mem == wp->mem_size) {
+    wp->mem_size = (wp->mem_size == 0 ? 4 : wp->mem_size * 2);
+    wp->mem = realloc(wp->mem, sizeof(*wp->mem) * wp->mem_size);
+    assert(wp->mem);
+  }
+  wp->mem[wp->nr_mem ++] = (WPMem) { .addr = addr, .len = len };
+}
+
+static word_t eval_wp(WP *wp, bool *success) {
+  wp->nr_mem = 0;
+  word_t value = expr_run(&wp->code, success, record_read, wp);
+  count_mem();
+  return value;
+}
 
 WP* new_wp() {
-  if (free_ == NULL) return NULL;
-  WP *new_wp = free_;
-  free_ = free_->next;
-  if (free_ != NULL) {
-    free_->prev = NULL;
-  }
-  new_wp->next = NULL;
-  new_wp->NO = ++wp_seq;
+  WP *new_wp = calloc(1, sizeof(WP));
+  assert(new_wp);
+  new_wp->NO = new_point_NO();
   if (head == NULL) {
-    new_wp->prev = NULL;
     head = new_wp;
     return new_wp;
   }
@@ -75,28 +107,37 @@ void free_wp(WP *wp) {
   if (wp->next) wp->next->prev = wp->prev;
   if (wp->prev) wp->prev->next = wp->next;
   if (wp == head) head = wp->next;
-  if (free_ != NULL) {
-    free_->prev = wp;
-  }
-  wp->next = free_;
-  wp->prev = NULL;
-  free_ = wp;
+  expr_free(&wp->code);
+  free(wp->expr);
+  free(wp->reg);
+  free(wp->mem);
+  free(wp);
+  count_mem();
 }
 
 bool add_wp(char *s_expr) {
-  bool success = true;
-  word_t value = expr(s_expr, &success);
-  if (!success) {
+  ExprCode code;
+  if (!expr_compile(s_expr, &code)) {
     printf("invalid expression: %s\n", s_expr);
     return false;
   }
   WP *p_wp = new_wp();
-  if (p_wp == NULL) {
-    printf("watchpoint pool full\n");
+  p_wp->expr = strdup(s_expr);
+  p_wp->code = code;
+  for (int i = 0; i < code.nr_op; i ++) {
+    if (code.op[i].name != NULL) p_wp->always = true;
+    if (code.op[i].reg == NULL) continue;
+    p_wp->reg = realloc(p_wp->reg, sizeof(*p_wp->reg) * (p_wp->nr_reg + 1));
+    assert(p_wp->reg);
+    p_wp->reg[p_wp->nr_reg ++] = (WPReg) { .ptr = code.op[i].reg, .val = *code.op[i].reg };
+  }
+  bool success = true;
+  p_wp->value = eval_wp(p_wp, &success);
+  if (!success) {
+    printf("invalid expression: %s\n", s_expr);
+    free_wp(p_wp);
     return false;
   }
-  strcpy(p_wp->expr, s_expr);
-  p_wp->value = value;
   printf("watchpoint No.%d \"%s\" = " FMT_WORD "\n", p_wp->NO, p_wp->expr, p_wp->value);
   return true;
 }
@@ -108,7 +149,6 @@ bool del_wp(int n) {
       return true;
     }
   }
-  printf("watchpoint %d does not exist\n", n);
   return false;
 }
 
@@ -117,18 +157,48 @@ void display_wp() {
   for (WP *p = head; p != NULL; p = p->next) {
     printf("No.%d \"%s\" = " FMT_WORD "\n", p->NO, p->expr, p->value);
   }
+  IFDEF(CONFIG_MEMWATCH, display_mwp());
+}
+
+// called before the guest stores to [addr, addr + len)
+void wp_store(vaddr_t addr, int len) {
+  for (WP *p = head; p != NULL; p = p->next) {
+    for (int i = 0; i < p->nr_mem && !p->dirty; i ++) {
+      if (addr < p->mem[i].addr + p->mem[i].len && p->mem[i].addr < addr + len) p->dirty = true;
+    }
+  }
 }
 
 bool check_wp() {
   bool change = false;
   for (WP *p = head; p != NULL; p = p->next) {
+    bool dirty = p->dirty || p->always;
+    for (int i = 0; i < p->nr_reg; i ++) {
+      if (*p->reg[i].ptr != p->reg[i].val) {
+        p->reg[i].val = *p->reg[i].ptr;
+        dirty = true;
+      }
+    }
+    if (!dirty) continue;
+    p->dirty = false;
     bool success = true;
-    word_t value = expr(p->expr, &success);
+    word_t value = eval_wp(p, &success);
     if (value != p->value) {
-      printf("watchpoint No.%d \"%s\" " FMT_WORD " -> " FMT_WORD "\n", p->NO, p->expr, p->value, value);
+      if (!point_quiet) printf("watchpoint No.%d \"%s\" " FMT_WORD " -> " FMT_WORD "\n", p->NO, p->expr, p->value, value);
       p->value = value;
+      point_stop.type = STOP_WP;
       change = true;
     }
   }
   return change;
 }
+
+// evaluate the watchpoints again after the guest state is restored, without reporting
+void wp_resync() {
+  for (WP *p = head; p != NULL; p = p->next) {
+    for (int i = 0; i < p->nr_reg; i ++) p->reg[i].val = *p->reg[i].ptr;
+    p->dirty = false;
+    bool success = true;
+    p->value = eval_wp(p, &success);
+  }
+}
@@ -0,0 +1,125 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <trace-def.h>
+
+#ifdef CONFIG_BTRACE
+
+extern uint64_t g_nr_guest_inst;
+
+uint32_t btrace_mask = 0;
+
+// Every category has its own ring, so frequent records (e.g. mem)
+// do not flush rare ones (e.g. exc) out of the ring.
+#define RING_SIZE CONFIG_BTRACE_RING_SIZE
+static TraceRecord ring[NR_TRACE_CAT][RING_SIZE];
+static uint32_t ring_idx[NR_TRACE_CAT] = {};
+static uint64_t ring_count[NR_TRACE_CAT] = {};
+static FILE *trace_fp = NULL;
+
+#define TRACE_CAT_NAME(x) str(x),
+static const char *cat_name[] = { TRACE_CATS(TRACE_CAT_NAME) };
+
+static void write_header(FILE *fp) {
+  TraceHeader h = { .version = TRACE_VERSION, .record_size = sizeof(TraceRecord) };
+  memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+  strncpy(h.isa, str(__GUEST_ISA__), sizeof(h.isa) - 1);
+  fwrite(&h, sizeof(h), 1, fp);
+}
+
+void btrace_record(int cat, int type, int len, uint64_t a, uint64_t b, uint64_t c) {
+  uint32_t i = ring_idx[cat];
+  ring[cat][i] = (TraceRecord) { .inst = g_nr_guest_inst, .a = a, .b = b, .c = c,
+    .cat = cat, .type = type, .len = len };
+  ring_count[cat] ++;
+  if (++ i == RING_SIZE) {
+    i = 0;
+    // the ring works as the write buffer when streaming
+    if (trace_fp != NULL) fwrite(ring[cat], sizeof(TraceRecord), RING_SIZE, trace_fp);
+  }
+  ring_idx[cat] = i;
+}
+
+// `list' is a comma separated list of categories, or "all", or "none"
+bool btrace_set_mask(const char *list) {
+  uint32_t mask = 0;
+  char buf[128];
+  strncpy(buf, list, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = '\0';
+  for (char *s = strtok(buf, ","); s != NULL; s = strtok(NULL, ",")) {
+    if (strcmp(s, "all") == 0) { mask = BITMASK(NR_TRACE_CAT); continue; }
+    if (strcmp(s, "none") == 0) { mask = 0; continue; }
+    int i;
+    for (i = 0; i < NR_TRACE_CAT; i ++) {
+      if (strcmp(s, cat_name[i]) == 0) { mask |= 1u << i; break; }
+    }
+    if (i == NR_TRACE_CAT) {
+      printf("unknown trace category '%s'\n", s);
+      return false;
+    }
+  }
+  btrace_mask = mask;
+  return true;
+}
+
+void btrace_display() {
+  for (int i = 0; i < NR_TRACE_CAT; i ++) {
+    printf("%-5s %-3s %" PRIu64 " record(s)\n", cat_name[i],
+        (btrace_mask & (1u << i)) ? "on" : "off", ring_count[i]);
+  }
+  printf("records are %s\n", trace_fp ? "streamed to the trace file" :
+      "kept in the rings, use `trace dump FILE' to save them");
+}
+
+// write the records which are not written yet
+static void flush(FILE *fp, bool whole_ring) {
+  for (int i = 0; i < NR_TRACE_CAT; i ++) {
+    if (whole_ring && ring_count[i] >= RING_SIZE) {
+      // the oldest records are after the current index
+      fwrite(&ring[i][ring_idx[i]], sizeof(TraceRecord), RING_SIZE - ring_idx[i], fp);
+    }
+    fwrite(ring[i], sizeof(TraceRecord), ring_idx[i], fp);
+  }
+  fflush(fp);
+}
+
+bool btrace_dump(const char *file) {
+  FILE *fp = fopen(file, "wb");
+  if (fp == NULL) {
+    printf("cannot open file %s\n", file);
+    return false;
+  }
+  write_header(fp);
+  flush(fp, true);
+  fclose(fp);
+  return true;
+}
+
+static void btrace_close() {
+  flush(trace_fp, false);
+  fclose(trace_fp);
+  trace_fp = NULL;
+}
+
+void btrace_open(const char *file) {
+  trace_fp = fopen(file, "wb");
+  Assert(trace_fp, "Can not open '%s'", file);
+  write_header(trace_fp);
+  atexit(btrace_close);
+  Log("Binary trace is written to %s", file);
+}
+
+#endif
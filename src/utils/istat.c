@@ -0,0 +1,195 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <cpu/reverse.h>
+
+#ifdef CONFIG_ISTAT
+
+/* Instruction statistics. Each INSTPAT has its own counter, registered
+ * when it is first matched, so counting an instruction costs a single
+ * increment; the counters of the same name are merged in the report.
+ * The loads and stores are counted by vaddr_read() and vaddr_write(),
+ * the devices by map_read() and map_write(), the traps and branches by
+ * the ISA, and the TLB lookups by the ISA with a TLB. The accesses made
+ * while NEMU is not running come from the debugger and are not counted,
+ * neither are the instructions executed again by the reverse replay, so
+ * the statistics are about the instructions up to the present.
+ */
+
+#define NR_DEVICE 32
+#define NR_TRAP 64
+
+extern uint64_t g_nr_guest_inst;
+
+uint64_t istat_load[9] = {}, istat_store[9] = {};
+uint64_t istat_branch[2] = {};  // not taken, taken
+uint64_t istat_tlb[2] = {};     // miss, hit
+
+static IStatInst *inst_list = NULL;
+static struct { const char *name; uint64_t nr[2]; } device[NR_DEVICE];
+static struct { word_t NO; uint64_t nr; } trap[NR_TRAP];
+static int nr_device = 0, nr_trap = 0;
+static const char *json_file = NULL;
+
+typedef struct {
+  const char *name;
+  uint64_t count;
+} InstCount;
+
+void istat_register(IStatInst *p) {
+  p->next = inst_list;
+  inst_list = p;
+}
+
+void istat_device(const char *name, bool is_write) {
+  if (!istat_enabled()) return;
+  int i;
+  for (i = 0; i < nr_device && device[i].name != name; i ++);
+  if (i == nr_device) {
+    if (nr_device == NR_DEVICE) return;
+    device[nr_device ++].name = name;
+  }
+  device[i].nr[is_write] ++;
+}
+
+void istat_trap(word_t NO) {
+  if (!istat_enabled()) return;
+  int i;
+  for (i = 0; i < nr_trap && trap[i].NO != NO; i ++);
+  if (i == nr_trap) {
+    if (nr_trap == NR_TRAP) return;
+    trap[nr_trap ++].NO = NO;
+  }
+  trap[i].nr ++;
+}
+
+static int cmp_count(const void *a, const void *b) {
+  const InstCount *x = a, *y = b;
+  return x->count < y->count ? 1 : x->count > y->count ? -1 : strcmp(x->name, y->name);
+}
+
+// merge the counters by name, sorted by count, return the number of names
+static int inst_mix(InstCount **res) {
+  int n = 0;
+  for (IStatInst *p = inst_list; p != NULL; p = p->next) n ++;
+  InstCount *mix = malloc(sizeof(*mix) * (n + 1));
+  assert(mix);
+  n = 0;
+  for (IStatInst *p = inst_list; p != NULL; p = p->next) {
+    int i;
+    for (i = 0; i < n && strcmp(mix[i].name, p->name) != 0; i ++);
+    if (i == n) mix[n ++] = (InstCount) { .name = p->name };
+    mix[i].count += p->count;
+  }
+  qsort(mix, n, sizeof(*mix), cmp_count);
+  *res = mix;
+  return n;
+}
+
+static double percent(uint64_t a, uint64_t total) {
+  return total == 0 ? 0 : a * 100.0 / total;
+}
+
+static uint64_t nr_inst() {
+  return MUXDEF(CONFIG_REVERSE, rev_present_inst(), g_nr_guest_inst);
+}
+
+void istat_display() {
+  InstCount *mix;
+  int n = inst_mix(&mix);
+  uint64_t total = nr_inst();
+  printf("instruction mix of %" PRIu64 " instructions:\n%14s %7s  %s\n", total, "count", "%", "name");
+  uint64_t sum = 0;
+  for (int i = 0; i < n; i ++) {
+    printf("%14" PRIu64 " %6.2f%%  %s\n", mix[i].count, percent(mix[i].count, total), mix[i].name);
+    sum += mix[i].count;
+  }
+  free(mix);
+  // every instruction matches a single INSTPAT, except the prefixes of x86
+  if (!MUXDEF(CONFIG_ISA_x86, true, false) && sum != total) {
+    printf("warning: the mix counts %" PRIu64 " instructions, it does not sum to 100%%\n", sum);
+  }
+
+  static const char *what[] = { "loads", "stores" };
+  uint64_t *mem[] = { istat_load, istat_store };
+  for (int k = 0; k < 2; k ++) {
+    printf("%-9s", what[k]);
+    for (int len = 1; len <= 8; len *= 2) printf("%s %d byte(s): %" PRIu64, len > 1 ? "," : "", len, mem[k][len]);
+    printf("\n");
+  }
+  uint64_t nr_branch = istat_branch[0] + istat_branch[1];
+  printf("branches  taken: %" PRIu64 " (%.2f%%), not taken: %" PRIu64 "\n",
+      istat_branch[1], percent(istat_branch[1], nr_branch), istat_branch[0]);
+  for (int i = 0; i < nr_device; i ++) {
+    printf("device %-12s read: %" PRIu64 ", write: %" PRIu64 "\n", device[i].name, device[i].nr[0], device[i].nr[1]);
+  }
+  for (int i = 0; i < nr_trap; i ++) {
+    printf("trap " FMT_WORD "  %" PRIu64 "\n", trap[i].NO, trap[i].nr);
+  }
+  uint64_t nr_tlb = istat_tlb[0] + istat_tlb[1];
+  if (nr_tlb > 0) {
+    printf("TLB       hit: %" PRIu64 " (%.2f%%), miss: %" PRIu64 "\n",
+        istat_tlb[1], percent(istat_tlb[1], nr_tlb), istat_tlb[0]);
+  }
+}
+
+static void istat_json(FILE *fp) {
+  InstCount *mix;
+  int n = inst_mix(&mix);
+  fprintf(fp, "{\n  \"instructions\": %" PRIu64 ",\n  \"mix\": {", nr_inst());
+  for (int i = 0; i < n; i ++) fprintf(fp, "%s\"%s\": %" PRIu64, i ? ", " : "", mix[i].name, mix[i].count);
+  free(mix);
+  fprintf(fp, "},\n  \"load\": {\"1\": %" PRIu64 ", \"2\": %" PRIu64 ", \"4\": %" PRIu64 ", \"8\": %" PRIu64 "},\n",
+      istat_load[1], istat_load[2], istat_load[4], istat_load[8]);
+  fprintf(fp, "  \"store\": {\"1\": %" PRIu64 ", \"2\": %" PRIu64 ", \"4\": %" PRIu64 ", \"8\": %" PRIu64 "},\n",
+      istat_store[1], istat_store[2], istat_store[4], istat_store[8]);
+  fprintf(fp, "  \"branch\": {\"taken\": %" PRIu64 ", \"not_taken\": %" PRIu64 "},\n  \"device\": {",
+      istat_branch[1], istat_branch[0]);
+  for (int i = 0; i < nr_device; i ++) {
+    fprintf(fp, "%s\"%s\": {\"read\": %" PRIu64 ", \"write\": %" PRIu64 "}",
+        i ? ", " : "", device[i].name, device[i].nr[0], device[i].nr[1]);
+  }
+  fprintf(fp, "},\n  \"trap\": {");
+  for (int i = 0; i < nr_trap; i ++) {
+    fprintf(fp, "%s\"" FMT_WORD "\": %" PRIu64, i ? ", " : "", trap[i].NO, trap[i].nr);
+  }
+  fprintf(fp, "}");
+  if (istat_tlb[0] + istat_tlb[1] > 0) {
+    fprintf(fp, ",\n  \"tlb\": {\"hit\": %" PRIu64 ", \"miss\": %" PRIu64 "}", istat_tlb[1], istat_tlb[0]);
+  }
+  fprintf(fp, "\n}\n");
+}
+
+static void istat_exit() {
+  istat_display();
+  if (json_file != NULL) {
+    FILE *fp = fopen(json_file, "w");
+    if (fp == NULL) {
+      printf("can not open '%s'\n", json_file);
+      return;
+    }
+    istat_json(fp);
+    fclose(fp);
+  }
+}
+
+// FILE is for the statistics in JSON, NULL if they are only shown at exit
+void istat_init(const char *file) {
+  json_file = file;
+  atexit(istat_exit);
+}
+
+#endif
@@ -20,6 +20,176 @@ extern uint64_t g_nr_guest_inst;
 #ifndef CONFIG_TARGET_AM
 FILE *log_fp = NULL;
 
+#ifdef CONFIG_LOG_ASYNC
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+/* The execution thread only copies the formatted text into a lock-free
+ * single-producer single-consumer ring. A writer thread drains the ring
+ * with large write(2) calls. `rb_head' and `rb_tail' only increase, the
+ * position in the ring is taken modulo its size.
+ *
+ * A thread which finds nothing to do sleeps on a condition variable after
+ * announcing it in `writer_waiting' or `producer_waiting', and the other
+ * side only takes the lock to wake it up when it has announced so.
+ */
+#define RB_SIZE CONFIG_LOG_ASYNC_BUF_SIZE
+static_assert((RB_SIZE & (RB_SIZE - 1)) == 0, "LOG_ASYNC_BUF_SIZE should be a power of 2");
+static char *rb = NULL;
+static _Atomic uint64_t rb_head = 0, rb_tail = 0;
+static atomic_bool writer_stop = false;
+static atomic_bool writer_waiting = false, producer_waiting = false;
+static pthread_mutex_t rb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rb_data = PTHREAD_COND_INITIALIZER;   // the ring is not empty
+static pthread_cond_t rb_space = PTHREAD_COND_INITIALIZER;  // the writer thread makes space
+static pthread_t writer_thread;
+static int log_fd = -1;
+static bool log_async = false;
+static uint64_t nr_full = 0, nr_drop = 0, nr_drop_bytes = 0;
+
+static void write_all(const char *buf, size_t n) {
+  while (n > 0) {
+    ssize_t ret = write(log_fd, buf, n);
+    if (ret <= 0) return; // nothing can be done if the log file is broken
+    buf += ret;
+    n -= ret;
+  }
+}
+
+// `waiting' is stored before the ring is checked again, and the other side
+// updates the ring before it checks `waiting', so one of them sees the other
+static void wake(atomic_bool *waiting, pthread_cond_t *cond) {
+  if (!atomic_load(waiting)) return;
+  pthread_mutex_lock(&rb_lock);
+  pthread_cond_broadcast(cond);
+  pthread_mutex_unlock(&rb_lock);
+}
+
+static void *log_writer(void *arg) {
+  while (true) {
+    uint64_t head = atomic_load_explicit(&rb_head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&rb_tail, memory_order_acquire);
+    if (head == tail) {
+      pthread_mutex_lock(&rb_lock);
+      atomic_store(&writer_waiting, true);
+      while (atomic_load(&rb_tail) == head && !atomic_load(&writer_stop)) {
+        pthread_cond_wait(&rb_data, &rb_lock);
+      }
+      atomic_store(&writer_waiting, false);
+      pthread_mutex_unlock(&rb_lock);
+      if (atomic_load(&rb_tail) == head) break;
+      continue;
+    }
+    // everything available is written at once, until the end of the ring
+    uint64_t off = head & (RB_SIZE - 1);
+    uint64_t n = tail - head;
+    if (n > RB_SIZE - off) n = RB_SIZE - off;
+    write_all(rb + off, n);
+    atomic_store(&rb_head, head + n);
+    wake(&producer_waiting, &rb_space);
+  }
+  return NULL;
+}
+
+static inline uint64_t rb_free(uint64_t tail) {
+  return RB_SIZE - (tail - atomic_load_explicit(&rb_head, memory_order_acquire));
+}
+
+// wait until the writer thread makes `len' bytes of space in the ring
+static void wait_space(uint64_t tail, size_t len) {
+  pthread_mutex_lock(&rb_lock);
+  atomic_store(&producer_waiting, true);
+  while (RB_SIZE - (tail - atomic_load(&rb_head)) < len) {
+    pthread_cond_wait(&rb_space, &rb_lock);
+  }
+  atomic_store(&producer_waiting, false);
+  pthread_mutex_unlock(&rb_lock);
+}
+
+static void log_async_write(const char *s, size_t len) {
+  uint64_t tail = atomic_load_explicit(&rb_tail, memory_order_relaxed);
+  if (len > RB_SIZE) len = RB_SIZE;
+  if (rb_free(tail) < len) {
+    nr_full ++;
+#ifdef CONFIG_LOG_ASYNC_DROP
+    nr_drop ++;
+    nr_drop_bytes += len;
+    return;
+#else
+    wait_space(tail, len);
+#endif
+  }
+  uint64_t off = tail & (RB_SIZE - 1);
+  size_t n = len < RB_SIZE - off ? len : RB_SIZE - off;
+  memcpy(rb + off, s, n);
+  memcpy(rb, s + n, len - n);
+  atomic_store(&rb_tail, tail + len);
+  wake(&writer_waiting, &rb_data);
+}
+
+void log_async_printf(const char *fmt, ...) {
+  char buf[512];
+  va_list ap;
+  va_start(ap, fmt);
+  if (!log_async) {
+    vfprintf(log_fp, fmt, ap);
+    fflush(log_fp);
+    va_end(ap);
+    return;
+  }
+  int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (len < 0) return;
+  if (len < sizeof(buf)) { log_async_write(buf, len); return; }
+  char *p = malloc(len + 1);
+  assert(p);
+  va_start(ap, fmt);
+  vsnprintf(p, len + 1, fmt, ap);
+  va_end(ap);
+  log_async_write(p, len);
+  free(p);
+}
+
+// wait until the writer thread drains the ring
+static void drain() {
+  uint64_t tail = atomic_load_explicit(&rb_tail, memory_order_relaxed);
+  if (rb_free(tail) != RB_SIZE) wait_space(tail, RB_SIZE);
+}
+
+void log_flush() {
+  if (!log_async) return;
+  drain();
+  if (nr_full > 0) {
+    printf("The log buffer was full for %" PRIu64 " time(s)", nr_full);
+    if (nr_drop > 0) printf(", %" PRIu64 " message(s) (%" PRIu64 " bytes) are dropped", nr_drop, nr_drop_bytes);
+    printf("\n");
+  }
+}
+
+static void log_async_exit() {
+  drain();
+  atomic_store(&writer_stop, true);
+  wake(&writer_waiting, &rb_data);
+  pthread_join(writer_thread, NULL);
+  log_async = false;
+}
+
+static void init_log_async() {
+  // stdout is shared with printf(), keep the order of messages there
+  if (log_fp == stdout) return;
+  rb = malloc(RB_SIZE);
+  assert(rb);
+  fflush(log_fp);
+  log_fd = fileno(log_fp);
+  int ret = pthread_create(&writer_thread, NULL, log_writer, NULL);
+  Assert(ret == 0, "Can not create the log writer thread");
+  log_async = true;
+  atexit(log_async_exit);
+}
+#endif
+
 void init_log(const char *log_file) {
   log_fp = stdout;
   if (log_file != NULL) {
@@ -27,7 +197,9 @@ void init_log(const char *log_file) {
     Assert(fp, "Can not open '%s'", log_file);
     log_fp = fp;
   }
-  Log("Log is written to %s", log_file ? log_file : "stdout");
+  IFDEF(CONFIG_LOG_ASYNC, init_log_async());
+  Log("Log is written to %s%s", log_file ? log_file : "stdout",
+      MUXDEF(CONFIG_LOG_ASYNC, log_async ? " by a background thread" : "", ""));
 }
 
 bool log_enable() {
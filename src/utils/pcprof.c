@@ -0,0 +1,164 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <isa.h>
+#include <monitor/sdb.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#ifdef CONFIG_PCPROF
+
+/* Sampling PC profiler. Every N guest instructions, or on every SIGPROF
+ * tick of the host, the pc of the instruction just executed is counted
+ * in a hash histogram, together with the start of its basic block (the
+ * target of the last taken jump). The samples are symbolized at exit.
+ */
+
+typedef struct {
+  vaddr_t pc, bb;
+  uint64_t count;
+} Sample;
+
+uint64_t pcprof_countdown = UINT64_MAX;  // only touched by the thread running the guest
+volatile sig_atomic_t pcprof_tick = 0;    // set by the host timer
+vaddr_t pcprof_bb = 0;
+static uint64_t interval = 0;  // 0 for the host timer
+static Sample *hist = NULL;
+static uint32_t hist_size = 0, nr_pc = 0;
+static uint64_t nr_sample = 0;
+
+static inline uint32_t hash(vaddr_t pc) {
+  return ((uint64_t)pc * 0x9e3779b97f4a7c15ull) >> 32;
+}
+
+static void hist_grow() {
+  Sample *old = hist;
+  uint32_t old_size = hist_size;
+  hist_size = (hist_size == 0 ? 4096 : hist_size * 2);
+  hist = calloc(hist_size, sizeof(*hist));
+  Assert(hist != NULL, "no memory for pc profiler");
+  for (uint32_t i = 0; i < old_size; i ++) {
+    if (old[i].count == 0) continue;
+    uint32_t j = hash(old[i].pc) & (hist_size - 1);
+    while (hist[j].count != 0) j = (j + 1) & (hist_size - 1);
+    hist[j] = old[i];
+  }
+  free(old);
+}
+
+void pcprof_sample(vaddr_t pc) {
+  pcprof_countdown = (interval == 0 ? UINT64_MAX : interval);
+  pcprof_tick = 0;
+  if (nr_pc * 2 >= hist_size) hist_grow();
+  uint32_t i = hash(pc) & (hist_size - 1);
+  while (hist[i].count != 0 && hist[i].pc != pc) i = (i + 1) & (hist_size - 1);
+  if (hist[i].count == 0) {
+    hist[i].pc = pc;
+    hist[i].bb = pcprof_bb;
+    nr_pc ++;
+  }
+  hist[i].count ++;
+  nr_sample ++;
+}
+
+static void tick(int sig) {
+  pcprof_tick = 1;
+}
+
+typedef struct {
+  vaddr_t key;
+  int func;
+  uint64_t count;
+} Hot;
+
+static int hot_cmp(const void *a, const void *b) {
+  const Hot *x = a, *y = b;
+  if (x->count != y->count) return x->count < y->count ? 1 : -1;
+  return x->key < y->key ? -1 : (x->key > y->key);
+}
+
+static int key_cmp(const void *a, const void *b) {
+  const Hot *x = a, *y = b;
+  return x->key < y->key ? -1 : (x->key > y->key);
+}
+
+// merge the samples of the same key, and sort them by count
+static int merge(Hot *h, int n) {
+  qsort(h, n, sizeof(*h), key_cmp);
+  int m = 0;
+  for (int i = 0; i < n; i ++) {
+    if (m > 0 && h[m - 1].key == h[i].key) h[m - 1].count += h[i].count;
+    else h[m ++] = h[i];
+  }
+  qsort(h, m, sizeof(*h), hot_cmp);
+  return m;
+}
+
+static const char *func_name(int func) {
+  return func >= 0 ? function_list[func].name : "??";
+}
+
+static void pcprof_report() {
+  if (nr_sample == 0) return;
+  Hot *h = malloc(sizeof(*h) * nr_pc);
+  int n = 0;
+  for (uint32_t i = 0; i < hist_size; i ++) {
+    if (hist[i].count == 0) continue;
+    h[n ++] = (Hot) { .key = hist[i].bb, .func = search_function(hist[i].pc), .count = hist[i].count };
+  }
+
+  printf("%" PRIu64 " samples of %d pc(s)\n", nr_sample, nr_pc);
+  printf("hot basic blocks:\n%12s %7s  %-10s  %s\n", "samples", "%", "block", "function");
+  int m = merge(h, n);
+  for (int i = 0; i < m && i < CONFIG_PCPROF_TOP; i ++) {
+    printf("%12" PRIu64 " %6.2f%%  " FMT_WORD "  %s\n", h[i].count, h[i].count * 100.0 / nr_sample,
+        h[i].key, func_name(h[i].func));
+  }
+
+  // the block of a function is the function itself
+  for (int i = 0; i < m; i ++) h[i].key = h[i].func;
+  m = merge(h, m);
+  printf("hot functions:\n%12s %7s  %s\n", "samples", "%", "function");
+  for (int i = 0; i < m && i < CONFIG_PCPROF_TOP; i ++) {
+    printf("%12" PRIu64 " %6.2f%%  %s\n", h[i].count, h[i].count * 100.0 / nr_sample, func_name(h[i].func));
+  }
+  free(h);
+}
+
+// ARG is the number of instructions between two samples, or the
+// period of the host timer with the suffix `us'
+void pcprof_start(const char *arg) {
+  char *end;
+  uint64_t n = strtoull(arg, &end, 0);
+  bool timer = (strcmp(end, "us") == 0);
+  if (n == 0 || (*end != '\0' && !timer)) panic("bad sampling interval '%s'", arg);
+  if (timer) {
+    struct sigaction sa = { .sa_handler = tick, .sa_flags = SA_RESTART };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+    struct itimerval it = { .it_interval = { n / 1000000, n % 1000000 }, .it_value = { n / 1000000, n % 1000000 } };
+    setitimer(ITIMER_PROF, &it, NULL);
+  } else {
+    interval = n;
+    pcprof_countdown = n;
+  }
+  pcprof_bb = cpu.pc;
+  hist_grow();
+  atexit(pcprof_report);
+  Log("sample the pc every %" PRIu64 " %s", n, timer ? "us of host CPU time" : "instructions");
+}
+
+#endif
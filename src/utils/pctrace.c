@@ -0,0 +1,94 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <pctrace-def.h>
+
+#ifdef CONFIG_PCTRACE
+
+/* Only the non-sequential control flow is recorded. Between two events
+ * the instructions are executed sequentially, so the whole PC sequence
+ * can be rebuilt from the events (see tools/pctrace-reader).
+ */
+
+extern uint64_t g_nr_guest_inst;
+
+#define BUF_SIZE (1 << 20)
+static uint8_t buf[BUF_SIZE];
+static int buf_len = 0;
+static FILE *pctrace_fp = NULL;
+static vaddr_t cur_pc = 0;        // where the current sequential run starts
+static uint64_t cur_inst = 0;     // g_nr_guest_inst when the run starts
+static uint64_t nr_event = 0;
+
+static inline void put_varint(uint64_t x) {
+  while (x >= 0x80) {
+    buf[buf_len ++] = (x & 0x7f) | 0x80;
+    x >>= 7;
+  }
+  buf[buf_len ++] = x;
+}
+
+static inline void put_event(int kind, uint64_t n, vaddr_t src, vaddr_t target) {
+  // an event takes at most 3 varints of 10 bytes
+  if (buf_len > BUF_SIZE - 32) {
+    fwrite(buf, 1, buf_len, pctrace_fp);
+    buf_len = 0;
+  }
+  int64_t delta = (int64_t)target - (int64_t)src;
+  put_varint((n << 2) | kind);
+  put_varint(src - cur_pc);
+  put_varint(((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63)); // zigzag
+  cur_pc = target;
+  nr_event ++;
+}
+
+bool pctrace_enabled = false;
+
+// the instruction at `pc' jumps to `target'
+void pctrace_jump(vaddr_t pc, vaddr_t target) {
+  put_event(PCTRACE_JUMP, g_nr_guest_inst - cur_inst, pc, target);
+  cur_inst = g_nr_guest_inst;
+}
+
+// an interrupt is taken before the instruction at `epc'
+void pctrace_trap(vaddr_t epc, vaddr_t target) {
+  put_event(PCTRACE_TRAP, g_nr_guest_inst - cur_inst, epc, target);
+  cur_inst = g_nr_guest_inst;
+}
+
+static void pctrace_close() {
+  // the last sequential run ends before `cpu.pc'
+  put_event(PCTRACE_END, g_nr_guest_inst - cur_inst, cpu.pc, cpu.pc);
+  fwrite(buf, 1, buf_len, pctrace_fp);
+  fclose(pctrace_fp);
+  pctrace_enabled = false;
+}
+
+void pctrace_open(const char *file) {
+  pctrace_fp = fopen(file, "wb");
+  Assert(pctrace_fp, "Can not open '%s'", file);
+  PCTraceHeader h = { .version = PCTRACE_VERSION,
+    .ilen = MUXDEF(CONFIG_ISA_x86, 0, 4), .entry = cpu.pc, .start_inst = g_nr_guest_inst };
+  memcpy(h.magic, PCTRACE_MAGIC, sizeof(h.magic));
+  fwrite(&h, sizeof(h), 1, pctrace_fp);
+  cur_pc = cpu.pc;
+  cur_inst = g_nr_guest_inst;
+  pctrace_enabled = true;
+  atexit(pctrace_close);
+  Log("PC trace is written to %s", file);
+}
+
+#endif
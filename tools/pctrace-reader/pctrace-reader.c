@@ -0,0 +1,109 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pctrace-def.h>
+
+// Read the PC trace written by NEMU (see src/utils/pctrace.c).
+
+static FILE *fp = NULL;
+
+static bool get_varint(uint64_t *x) {
+  *x = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int c = fgetc(fp);
+    if (c == EOF) return false;
+    *x |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) return true;
+  }
+  return false;
+}
+
+static void usage(const char *name) {
+  printf("Usage: %s [-f|-s] PC_TRACE_FILE\n", name);
+  printf("\t    print the control flow events\n");
+  printf("\t-f  print the pc of every instruction executed\n");
+  printf("\t-s  print the summary only\n");
+}
+
+int main(int argc, char *argv[]) {
+  char mode = 'e';
+  const char *file = NULL;
+  for (int i = 1; i < argc; i ++) {
+    if (strcmp(argv[i], "-f") == 0) mode = 'f';
+    else if (strcmp(argv[i], "-s") == 0) mode = 's';
+    else file = argv[i];
+  }
+  if (file == NULL) { usage(argv[0]); return 0; }
+
+  fp = fopen(file, "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "can not open '%s'\n", file);
+    return 1;
+  }
+  PCTraceHeader h;
+  if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, PCTRACE_MAGIC, sizeof(h.magic)) != 0) {
+    fprintf(stderr, "'%s' is not a NEMU PC trace file\n", file);
+    return 1;
+  }
+  if (h.version != PCTRACE_VERSION) {
+    fprintf(stderr, "'%s' is written by an incompatible NEMU (version %u)\n", file, h.version);
+    return 1;
+  }
+  if (mode == 'f' && h.ilen == 0) {
+    fprintf(stderr, "the length of instructions is variable, the pc of every instruction "
+        "can only be rebuilt with a disassembler\n");
+    return 1;
+  }
+
+  static const char *kind_name[] = { "jump", "trap", "end" };
+  uint64_t pc = h.entry, inst = h.start_inst, nr_event = 0;
+  bool end = false;
+  uint64_t head, src_off, zz;
+  while (get_varint(&head) && get_varint(&src_off) && get_varint(&zz)) {
+    int kind = head & 0x3;
+    uint64_t n = head >> 2;
+    uint64_t src = pc + src_off;
+    int64_t delta = (int64_t)(zz >> 1) ^ -(int64_t)(zz & 1);
+    uint64_t target = src + delta;
+    if (kind > PCTRACE_END) {
+      fprintf(stderr, "bad event #%" PRIu64 "\n", nr_event);
+      return 1;
+    }
+    if (mode == 'f') {
+      for (uint64_t i = 0; i < n; i ++) printf("%#010" PRIx64 "\n", pc + i * h.ilen);
+    } else if (mode == 'e') {
+      printf("%12" PRIu64 " %-4s %#010" PRIx64 " -> %#010" PRIx64 " (%" PRIu64 " instruction(s) from %#010" PRIx64 ")\n",
+          inst + n, kind_name[kind], src, target, n, pc);
+    }
+    inst += n;
+    pc = target;
+    nr_event ++;
+    if (kind == PCTRACE_END) { end = true; break; }
+  }
+  fclose(fp);
+
+  if (!end) fprintf(stderr, "the trace is truncated, NEMU may not exit normally\n");
+  if (mode == 's') {
+    printf("instructions = %" PRIu64 ", events = %" PRIu64 ", last pc = %#" PRIx64 "\n",
+        inst - h.start_inst, nr_event, pc);
+  }
+  return 0;
+}
@@ -0,0 +1,146 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <trace-def.h>
+
+// Decode the binary trace written by NEMU (see src/utils/btrace.c) into text.
+// Records of different categories are merged by the instruction count.
+
+#define TRACE_CAT_NAME(x) #x,
+static const char *cat_name[] = { TRACE_CATS(TRACE_CAT_NAME) };
+static const char *csr_op[] = { "?", "csrrw", "csrrs", "csrrc", "?", "csrrwi", "csrrsi", "csrrci" };
+
+static TraceHeader header;
+static uint32_t cat_mask = (1u << NR_TRACE_CAT) - 1;
+
+static int cmp(const void *a, const void *b) {
+  const TraceRecord *ra = *(const TraceRecord **)a, *rb = *(const TraceRecord **)b;
+  if (ra->inst != rb->inst) return ra->inst < rb->inst ? -1 : 1;
+  // keep the order in the file for records of the same instruction
+  return ra < rb ? -1 : (ra > rb);
+}
+
+static void print_inst(TraceRecord *r) {
+  uint8_t inst[16];
+  memcpy(inst, &r->b, 8);
+  memcpy(inst + 8, &r->c, 8);
+  int len = r->len > 16 ? 16 : r->len;
+  bool x86 = strcmp(header.isa, "x86") == 0;
+  printf("[itrace] %#010" PRIx64 ":", r->a);
+  for (int i = 0; i < len; i ++) {
+    printf(" %02x", inst[x86 ? i : len - 1 - i]);
+  }
+  printf("\n");
+}
+
+static void print_record(TraceRecord *r) {
+  printf("%12" PRIu64 " ", r->inst);
+  switch (r->cat) {
+    case TRACE_inst: print_inst(r); break;
+    case TRACE_mem:
+      printf("[mtrace] %s %d byte(s) %s %#" PRIx64 ", value = %#" PRIx64 "\n",
+          r->type == TRACE_READ ? "read" : "write", r->len,
+          r->type == TRACE_READ ? "from" : "to", r->a, r->b);
+      break;
+    case TRACE_dev:
+      printf("[dtrace] %s %d byte(s) %s %#" PRIx64 " (offset = %" PRIu64 "), value = %#" PRIx64 "\n",
+          r->type == TRACE_READ ? "read" : "write", r->len,
+          r->type == TRACE_READ ? "from" : "to", r->a, r->c, r->b);
+      break;
+    case TRACE_func:
+      printf("[ftrace] %s %#" PRIx64 " from %#" PRIx64 "\n",
+          r->type == TRACE_CALL ? "call" : "ret ", r->b, r->a);
+      break;
+    case TRACE_exc:
+      printf("[etrace] exception %#" PRIx64 " at pc %#" PRIx64 ", handler = %#" PRIx64 "\n",
+          r->b, r->a, r->c);
+      break;
+    case TRACE_csr:
+      printf("[csrtrace] %#" PRIx64 ": %s %#" PRIx64 ", src = %#" PRIx64 "\n",
+          r->a, csr_op[r->type & 0x7], r->b, r->c);
+      break;
+    default: printf("unknown record category %d\n", r->cat); break;
+  }
+}
+
+static void set_mask(char *list) {
+  cat_mask = 0;
+  for (char *s = strtok(list, ","); s != NULL; s = strtok(NULL, ",")) {
+    int i;
+    for (i = 0; i < NR_TRACE_CAT; i ++) {
+      if (strcmp(s, cat_name[i]) == 0) { cat_mask |= 1u << i; break; }
+    }
+    if (i == NR_TRACE_CAT) {
+      fprintf(stderr, "unknown trace category '%s'\n", s);
+      exit(1);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 3) {
+    printf("Usage: %s TRACE_FILE [CATEGORIES]\n", argv[0]);
+    printf("\tCATEGORIES is a comma separated list of");
+    for (int i = 0; i < NR_TRACE_CAT; i ++) printf(" %s", cat_name[i]);
+    printf(", all by default\n");
+    return 0;
+  }
+  if (argc == 3) set_mask(argv[2]);
+
+  FILE *fp = fopen(argv[1], "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "can not open '%s'\n", argv[1]);
+    return 1;
+  }
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+    fprintf(stderr, "'%s' is not a NEMU trace file\n", argv[1]);
+    return 1;
+  }
+  if (header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord)) {
+    fprintf(stderr, "'%s' is written by an incompatible NEMU (version %u, record size %u)\n",
+        argv[1], header.version, header.record_size);
+    return 1;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  size_t nr = (ftell(fp) - sizeof(header)) / sizeof(TraceRecord);
+  fseek(fp, sizeof(header), SEEK_SET);
+  TraceRecord *rec = malloc(nr * sizeof(TraceRecord) + 1);
+  TraceRecord **order = malloc(nr * sizeof(TraceRecord *) + 1);
+  if (rec == NULL || order == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  nr = fread(rec, sizeof(TraceRecord), nr, fp);
+  fclose(fp);
+
+  size_t n = 0;
+  for (size_t i = 0; i < nr; i ++) {
+    if (rec[i].cat < NR_TRACE_CAT && (cat_mask & (1u << rec[i].cat))) order[n ++] = &rec[i];
+  }
+  qsort(order, n, sizeof(order[0]), cmp);
+  for (size_t i = 0; i < n; i ++) print_record(order[i]);
+
+  free(order);
+  free(rec);
+  return 0;
+}